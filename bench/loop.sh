@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+#
+# Loop benchmark for dmsh
+#
+# Runs ITERATIONS (default 100,000) iterations of the same body once as
+# a compiled for loop and once as the equivalent unrolled script, where
+# every line is a separate statement of the program.
+#
+# Usage: bench/loop.sh [ITERATIONS]
+
+ITERATIONS=${1:-100000}
+DMSH=${DMSH:-./dmsh}
+SCRATCH=$(mktemp -d)
+
+trap 'rm -rf "$SCRATCH"' EXIT
+
+cat > "$SCRATCH/loop.dmsh" <<SCRIPT
+for i in {1..$ITERATIONS}; do
+    LAST=\$i
+    cd .
+done
+SCRIPT
+
+awk -v n="$ITERATIONS" 'BEGIN {
+    for (i = 1; i <= n; i++) {
+        print "LAST=" i
+        print "cd ."
+    }
+}' > "$SCRATCH/unrolled.dmsh"
+
+run() {
+    TIMEFORMAT="$(printf "%-10s" "$1") %R s"
+    time "$DMSH" "$2" > /dev/null
+}
+
+echo "$ITERATIONS iterations"
+run loop "$SCRATCH/loop.dmsh"
+run unrolled "$SCRATCH/unrolled.dmsh"
@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+#
+# Soak benchmark for dmsh
+#
+# Feeds COMMANDS lines (default 1,000,000) into one dmsh process and
+# samples its resident set size and open file descriptor count while
+# it runs. Most lines exercise the builtins, the parser and the
+# redirection paths; every EXTERNAL_EVERY-th line runs a forked
+# pipeline so the exec paths are covered as well.
+#
+# In a leak free steady state both the RSS and the fd columns stay flat.
+#
+# Usage: bench/soak.sh [COMMANDS] [EXTERNAL_EVERY] [SAMPLE_SECONDS]
+
+COMMANDS=${1:-1000000}
+EXTERNAL_EVERY=${2:-1000}
+SAMPLE_SECONDS=${3:-1}
+DMSH=${DMSH:-./dmsh}
+SCRATCH=$(mktemp -d)
+
+trap 'rm -rf "$SCRATCH"' EXIT
+
+generate() {
+    awk -v n="$COMMANDS" -v every="$EXTERNAL_EVERY" -v dir="$SCRATCH" 'BEGIN {
+        for (i = 1; i <= n; i++) {
+            if (i % every == 0)
+                print "true < /dev/null | true > " dir "/out.txt"
+            else if (i % 5 == 0)
+                print "export SOAK_VAR=" i
+            else if (i % 5 == 1)
+                print "cd " dir " && cd ."
+            else if (i % 5 == 2)
+                print "help > " dir "/help.txt"
+            else if (i % 5 == 3)
+                print "info >> /dev/null"
+            else
+                print "cd < /nonexistent"
+        }
+    }'
+}
+
+generate | "$DMSH" > /dev/null 2>&1 &
+PID=$!
+
+printf "%8s %12s %6s\n" "seconds" "rss_kb" "fds"
+START=$SECONDS
+while kill -0 "$PID" 2>/dev/null; do
+    RSS=$(awk '/^VmRSS/ { print $2 }' "/proc/$PID/status" 2>/dev/null)
+    FDS=$(ls "/proc/$PID/fd" 2>/dev/null | wc -l)
+    [ -n "$RSS" ] && printf "%8d %12s %6s\n" $((SECONDS - START)) "$RSS" "$FDS"
+    sleep "$SAMPLE_SECONDS"
+done
+wait "$PID"
+echo "finished $COMMANDS commands in $((SECONDS - START))s"
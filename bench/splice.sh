@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+#
+# Throughput benchmark for the cat and tee builtins
+#
+# Streams a SIZE (default 4G) file through a passthrough pipeline and
+# through a fan-out pipeline, once with the builtins (splice / tee /
+# copy_file_range) and once with the system binaries (enable -n).
+# The source is a sparse file so the disk does not limit the numbers.
+# The pipeline rewrites are switched off, they would fold the cat
+# stages into redirections and leave no pipe to measure.
+#
+# Usage: bench/splice.sh [SIZE]
+
+SIZE=${1:-4G}
+DMSH=${DMSH:-./dmsh}
+SCRATCH=$(mktemp -d)
+
+trap 'rm -rf "$SCRATCH"' EXIT
+truncate -s "$SIZE" "$SCRATCH/big"
+# Warm the page cache so the first run is not penalised
+cat "$SCRATCH/big" > /dev/null
+
+run() {
+    TIMEFORMAT="$(printf "%-24s" "$1") %R s"
+    time "$DMSH" -c "optimize off; $2" > /dev/null
+}
+
+PASSTHROUGH="cat $SCRATCH/big | cat | cat > /dev/null"
+FANOUT="cat $SCRATCH/big | tee $SCRATCH/log | cat > /dev/null"
+COPY="cat $SCRATCH/big > $SCRATCH/copy"
+
+echo "$SIZE stream"
+run "passthrough builtin" "$PASSTHROUGH"
+run "passthrough binary" "enable -n cat; $PASSTHROUGH"
+run "fan-out builtin" "$FANOUT"
+run "fan-out binary" "enable -n cat tee; $FANOUT"
+run "file copy builtin" "$COPY"
+run "file copy binary" "enable -n cat; $COPY"
@@ -30,16 +30,39 @@
  **************************************************/
 
 #include <map>
+#include <unordered_map>
+#include <set>
 #include <regex>
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <vector>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <csignal>
 #include <numeric>
+#include <iomanip>
 #include <iostream>
 #include <algorithm>
+#include <ctime>
+#include <dirent.h>
+#include <poll.h>
+#include <dlfcn.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/fcntl.h>
 
 /**
@@ -90,15 +113,24 @@
      * -------------
      * 0 -> Append
      * 1 -> Write
+ * 
+ * HereString is the text fed to stdin in place 
+ * of the pipe when it is not empty, it is only 
+ * set by the optimizer (echo x | cmd).
+ * 
+ * Literal[i] is set when Args[i] was single 
+ * quoted, such an argument is never expanded.
  */
 struct Atom
 {
     std::map<std::string, std::string> RuntimeVars;
     std::string Program;
     std::vector<std::string> Args;
+    std::vector<bool> Literal;
     std::string InputStream;
     std::string OutputStream;
     bool OutputMode;
+    std::string HereString;
 };
 
 /**
@@ -116,6 +148,12 @@ struct Block
 {
     std::vector<Atom *> Atoms;
     bool IsBackgroundProcess;
+
+    ~Block()
+    {
+        for (auto &atom : Atoms)
+            delete atom;
+    }
 };
 
 /**
@@ -128,6 +166,129 @@ struct Block
 struct Command
 {
     std::vector<Block *> Blocks;
+
+    ~Command()
+    {
+        for (auto &blk : Blocks)
+            delete blk;
+    }
+};
+
+/**
+ * Control flow  (if, while, for and  shell 
+ * functions) is compiled once into a flat
+ * list of operations over the Command tree
+ * so  that  loop  bodies are never parsed 
+ * again. Each Op is one of:
+ * 
+ * OP_RUN        ->  execute Cmd, sets $?
+ * OP_ASSIGN     ->  Name = expanded Words[0]
+ * OP_JUMP       ->  continue at Target
+ * OP_JUMP_FALSE ->  continue at Target if $? != 0
+ * OP_FOR_INIT   ->  expand Words into a new loop frame
+ * OP_FOR_NEXT   ->  Name = next word, or go to Target
+ *                   once the frame is exhausted
+ * OP_LOOP_END   ->  drop the innermost loop frame
+ * OP_DEFUN      ->  register Body as function Name
+ * OP_RETURN     ->  leave the program, $? = Words[0]
+ * 
+ * Literal[i] is set when Words[i] was single 
+ * quoted, such a word is never expanded.
+ * 
+ *  >>> for i in {1..3}; do echo $i; done
+ *  >>>   0  FOR_INIT  {1..3}
+ *  >>>   1  FOR_NEXT  i       -> 4
+ *  >>>   2  RUN       echo $i
+ *  >>>   3  JUMP              -> 1
+ *  >>>   4  LOOP_END
+ */
+enum OpCode
+{
+    OP_RUN,
+    OP_ASSIGN,
+    OP_JUMP,
+    OP_JUMP_FALSE,
+    OP_FOR_INIT,
+    OP_FOR_NEXT,
+    OP_LOOP_END,
+    OP_DEFUN,
+    OP_RETURN
+};
+
+struct Program;
+
+struct Op
+{
+    OpCode Code;
+    Command *Cmd;
+    size_t Target;
+    std::string Name;
+    std::vector<std::string> Words;
+    std::vector<bool> Literal;
+    std::shared_ptr<Program> Body;
+};
+
+/**
+ * A compiled program  owns  the  Command 
+ * trees referenced by its  operations.
+ */
+struct Program
+{
+    std::vector<Op> Ops;
+
+    ~Program()
+    {
+        for (auto &op : Ops)
+            delete op.Cmd;
+    }
+};
+
+/**
+ * Following structure holds the statistics 
+ * of one atom of a block  for  the  pipestat 
+ * report. Times are in seconds, bytes are the 
+ * totals read / written  by  the  syscalls of 
+ * the stage (rchar / wchar of /proc/<pid>/io).
+ * 
+ * Blocked is the time the stage was alive but 
+ * neither running nor waiting for a cpu, for 
+ * a pipeline stage that is the time spent 
+ * waiting on its pipes.
+ * 
+ * Negative values mean not available. That is 
+ * the MaxRss of a stage the shell ran itself, 
+ * getrusage only knows the peak of the shell.
+ */
+struct StageStat
+{
+    std::string Name;
+    pid_t Pid;
+    double Start;
+    double Wall;
+    double Cpu;
+    double Blocked;
+    long MaxRss;
+    long long ReadBytes;
+    long long WriteBytes;
+};
+
+/**
+ * Following structure holds the budgets of a 
+ * block given by the timeout prefix (or the 
+ * default deadline $DMSH_TIMEOUT). Zero means 
+ * no limit.
+ * 
+ * Timeout    ->  wall clock seconds, then SIGTERM
+ * KillAfter  ->  seconds from SIGTERM to SIGKILL
+ * CpuSeconds ->  RLIMIT_CPU of every stage
+ * Memory     ->  RLIMIT_AS of every stage (bytes)
+ */
+struct Limits
+{
+    double Timeout;
+    double KillAfter;
+    long CpuSeconds;
+    long long Memory;
 };
 
 /**********************************************
@@ -136,11 +297,40 @@ struct Command
  * global_envp  = global environment varables *
  * running_jobs = all jobs that are currently *
  *                running                     *
+ * queue        = compiled programs kept for  *
+ *                the history builtin, holds  *
+ *                at most HISTORY_LIMIT items *
+ * exported_env = storage owning the strings  *
+ *                that export adds to envp    *
+ * shell_vars   = variables set by NAME=VALUE *
+ *                and by the for loops        *
+ * functions    = shell functions by name     *
+ * positional   = arguments of the running    *
+ *                script / function ($1 ...)  *
+ * last_status  = exit status of the last     *
+ *                command ($?)                *
+ * pipestat_enabled = report the per stage    *
+ *                statistics of every block   *
+ * tty_fd       = the controlling terminal or *
+ *                -1, handed to the process   *
+ *                group of a timed job        *
+ * aliases      = alias name -> replacement,  *
+ *                applied by the parser       *
  **********************************************/
 
+#define HISTORY_LIMIT 1000
+
 std::vector<char *> global_envp;
 std::vector<pid_t> running_jobs;
-std::vector<Command *> queue;
+std::vector<Program *> queue;
+std::map<std::string, std::string> exported_env;
+std::map<std::string, std::string> shell_vars;
+std::map<std::string, std::shared_ptr<Program>> functions;
+std::vector<std::vector<std::string>> positional(1);
+int last_status = 0;
+bool pipestat_enabled = false;
+int tty_fd = -1;
+std::map<std::string, std::string> aliases;
 
 /************************************
  *                                  *
@@ -159,9 +349,28 @@ std::vector<Command *> queue;
 namespace utility
 {
     std::string getPrompt();
-    void signal_callback_handler(int);
-    char **strToChrArr(std::string, const std::vector<std::string> &);
+    void interrupt();
+    void reapJobs();
+    char **strToChrArr(const std::string &, const std::vector<std::string> &);
     char **constructEnvArr(std::map<std::string, std::string>);
+    void freeEnvArr(char **);
+    std::string lookupVar(const std::string &);
+    std::string expand(const std::string &);
+    bool needsExpansion(const Block *);
+    Atom *expandAtom(const Atom *);
+    bool isLiteral(const Atom *, size_t);
+    std::vector<std::string> expandWords(const std::vector<std::string> &, const std::vector<bool> &);
+    long long copyFd(int, int);
+    double now();
+    void sampleStage(pid_t, StageStat &);
+    void printPipestat(const std::vector<StageStat> &);
+    bool parseDuration(const std::string &, double &);
+    bool parseSize(const std::string &, long long &);
+    void exportVar(const std::string &);
+    size_t arrBytes(char **);
+    int hereFd(const std::string &);
+    void armTimer(int, double);
+    void escalate(pid_t, int, bool &, double);
 } // namespace utility
 
 /**
@@ -177,13 +386,144 @@ namespace builtin
     int exit(std::vector<std::string> &);
     int history(std::vector<std::string> &);
     int exportEnv(std::vector<std::string> &);
-    std::map<std::string, int (*)(std::vector<std::string> &)> builtin_commands = {
+    int alias(std::vector<std::string> &);
+    int unalias(std::vector<std::string> &);
+    int echo(std::vector<std::string> &);
+    int trueCmd(std::vector<std::string> &);
+    int falseCmd(std::vector<std::string> &);
+    int test(std::vector<std::string> &);
+    int bracket(std::vector<std::string> &);
+    int printfCmd(std::vector<std::string> &);
+    int pwd(std::vector<std::string> &);
+    int sleepCmd(std::vector<std::string> &);
+    int enable(std::vector<std::string> &);
+    int cat(std::vector<std::string> &);
+    int tee(std::vector<std::string> &);
+    int external(const std::string &, std::vector<std::string> &);
+    int xargs(std::vector<std::string> &);
+    int pipestat(std::vector<std::string> &);
+    int optimize(std::vector<std::string> &);
+    int jobs(std::vector<std::string> &);
+    int exec(std::vector<std::string> &);
+    int load(const std::string &, const std::string &);
+
+    typedef int (*Function)(std::vector<std::string> &);
+
+    struct Entry
+    {
+        const char *Name;
+        Function Fn;
+    };
+
+    constexpr Entry builtin_commands[] = {
         {"cd", &cd},
         {"exit", &exit},
         {"info", &info},
         {"help", &help},
         {"export", &exportEnv},
-        {"history", &history}};
+        {"history", &history},
+        {"echo", &echo},
+        {"true", &trueCmd},
+        {"false", &falseCmd},
+        {"test", &test},
+        {"[", &bracket},
+        {"printf", &printfCmd},
+        {"pwd", &pwd},
+        {"sleep", &sleepCmd},
+        {"enable", &enable},
+        {"cat", &cat},
+        {"tee", &tee},
+        {"pipestat", &pipestat},
+        {"alias", &alias},
+        {"unalias", &unalias},
+        {"xargs", &xargs},
+        {"optimize", &optimize},
+        {"jobs", &jobs},
+        {"exec", &exec}};
+
+    /**
+     * The static builtins are found through a perfect 
+     * hash that is computed by the compiler: findSeed 
+     * searches  a  seed  for  which  every  name  of 
+     * builtin_commands lands in its own slot of a 
+     * HASH_SLOTS table. The hash lowercases on the 
+     * fly, so a lookup needs no copy of the program 
+     * name and at most one string comparison.
+     */
+    constexpr size_t builtin_count = sizeof(builtin_commands) / sizeof(Entry);
+    constexpr size_t HASH_SLOTS = 64;
+
+    constexpr char lower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    constexpr uint32_t hashName(const char *name, size_t len, uint32_t seed)
+    {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < len; i++)
+            h = (h ^ (unsigned char)lower(name[i])) * 16777619u;
+        return (h ^ (h >> 15)) & (HASH_SLOTS - 1);
+    }
+
+    constexpr size_t length(const char *str)
+    {
+        size_t len = 0;
+        while (str[len])
+            len++;
+        return len;
+    }
+
+    constexpr uint32_t findSeed()
+    {
+        for (uint32_t seed = 0;; seed++)
+        {
+            bool used[HASH_SLOTS] = {};
+            bool collision = false;
+            for (size_t i = 0; i < builtin_count && !collision; i++)
+            {
+                uint32_t slot = hashName(builtin_commands[i].Name, length(builtin_commands[i].Name), seed);
+                collision = used[slot];
+                used[slot] = true;
+            }
+            if (!collision)
+                return seed;
+        }
+    }
+
+    struct SlotTable
+    {
+        // Index into builtin_commands, -1 for an empty slot
+        int Index[HASH_SLOTS];
+    };
+
+    constexpr uint32_t hash_seed = findSeed();
+
+    constexpr SlotTable buildSlots()
+    {
+        SlotTable table = {};
+        for (size_t i = 0; i < HASH_SLOTS; i++)
+            table.Index[i] = -1;
+        for (size_t i = 0; i < builtin_count; i++)
+            table.Index[hashName(builtin_commands[i].Name, length(builtin_commands[i].Name), hash_seed)] = i;
+        return table;
+    }
+
+    constexpr SlotTable slots = buildSlots();
+    static_assert(builtin_count <= HASH_SLOTS / 2, "grow HASH_SLOTS along with builtin_commands");
+
+    // Builtins loaded by `enable -f`, by normalized name, with
+    // the handle of the shared object they come from
+    std::unordered_map<std::string, std::pair<Function, void *>> loaded;
+
+    // Builtins turned off by `enable -n`, the program
+    // of the same name is found through PATH instead.
+    // Names are kept in lower case, like lookup matches them
+    std::set<std::string> disabled;
+
+    int lookup(const std::string &);
+    Function find(const std::string &);
+    std::string normalize(const std::string &);
 
 } // namespace builtin
 
@@ -199,10 +539,69 @@ namespace executors
 {
     int execSingleCmd(Atom *, bool);
     int execute_atom(Atom *, bool);
-    int execute_block(Block *);
-    int execute(Command *);
+    int openStream(Atom *, bool);
+    pid_t spawn_atom(Atom *, bool, pid_t, int, const Limits *);
+    int waitStages(const std::vector<pid_t> &, std::vector<StageStat> *, const Limits *, pid_t);
+    int execute_cached(Block *, const Limits *);
+    bool parseLimits(Atom *, Limits &);
+    int execute_block(Block *, const Limits * = nullptr, bool = false);
+    int execute(Command *, bool = false);
+    int call(const std::shared_ptr<Program> &, std::vector<std::string> &);
+    int run(Program *, bool = false);
+    int replace(Atom *);
+    bool mayReplace();
 } // namespace executors
 
+/**
+ * The following namespace rewrites blocks right 
+ * before they run (after the variables are 
+ * substituted) to save processes and pipe 
+ * copies. Every pass keeps the output and the 
+ * status of the block as they were:
+ * 
+ * cat-in     ->  cat FILE | cmd    =>  cmd < FILE
+ *                (FILE is a readable regular file)
+ * cat-out    ->  cmd | cat         =>  cmd
+ *                (stdout is not a terminal, $? is 
+ *                still the one cat would return)
+ * echo-feed  ->  echo WORDS | cmd  =>  cmd <<< "WORDS"
+ * 
+ * The stage that ends up last has to be an 
+ * external program, a builtin or function there 
+ * would run in the shell itself (cd / | cat). 
+ * Blocks with limits (timeout, $DMSH_TIMEOUT) 
+ * are never rewritten, their status is the one 
+ * the deadline gives them. The passes are 
+ * switched with the optimize builtin, 
+ * `optimize trace on` reports every rewrite on 
+ * stderr.
+ */
+namespace optimizer
+{
+    enum Pass
+    {
+        CAT_IN = 1,
+        CAT_OUT = 2,
+        ECHO_FEED = 4
+    };
+
+    struct Info
+    {
+        const char *Name;
+        Pass Bit;
+    };
+
+    const Info passes[] = {{"cat-in", CAT_IN}, {"cat-out", CAT_OUT}, {"echo-feed", ECHO_FEED}};
+
+    unsigned enabled = CAT_IN | CAT_OUT | ECHO_FEED;
+    bool trace = false;
+
+    bool plain(const Atom *, const std::string &);
+    bool external(const Atom *);
+    std::string render(const Block *);
+    Block *rewrite(Block *, Block &, bool &);
+} // namespace optimizer
+
 /**
  * The following namespace contains the function 
  * that  are  utilized  for parsing the commands.
@@ -219,11 +618,293 @@ namespace parser
 {
     std::string trim(const std::string &trimStr);
     std::vector<std::string> splitString(const std::string &, const std::string &);
+    void splitWords(const std::string &, std::vector<std::string> &, std::vector<bool> &);
     Atom *getAtom(std::string &);
+    std::vector<std::string> splitPipes(const std::string &);
+    std::string expandAlias(const std::string &);
     Block *getBlock(std::string &);
     Command *Parse(const std::string &);
 } // namespace parser
 
+/**
+ * The following namespace compiles  whole  pieces 
+ * of  shell  source  (a script, a -c string or an 
+ * interactive  input spanning several lines) into 
+ * a Program. Every simple  statement  is  handed 
+ * over to parser::Parse exactly once, the control 
+ * flow keywords become jumps between them.
+ */
+namespace compiler
+{
+    enum State
+    {
+        COMPLETE,
+        INCOMPLETE,
+        ERROR
+    };
+
+    struct Source
+    {
+        std::vector<std::string> Statements;
+        size_t Pos;
+        State Status;
+        std::string Error;
+        // Pending break / continue jumps of the enclosing loops
+        std::vector<std::vector<size_t>> Breaks;
+        std::vector<size_t> Continues;
+    };
+
+    std::vector<std::string> splitStatements(const std::string &);
+    bool isComplete(const std::string &);
+    std::string compileList(Source &, Program *, const std::vector<std::string> &);
+    Program *Compile(const std::string &, State &, std::string &);
+} // namespace compiler
+
+/**
+ * The following namespace implements the store 
+ * behind the `cached` prefix. Outputs are kept 
+ * content addressed under objects/, entries/ 
+ * maps the fingerprint of a command to the 
+ * output object and its exit status:
+ * 
+ *  $DMSH_CACHE_DIR (default ~/.cache/dmsh)
+ *    |-- objects/<hash of the stdout>
+ *    |-- entries/<hash of the command>  ->  "<object> <status>"
+ *    |-- stats                           ->  "<hits> <misses>"
+ * 
+ * Only the outputs of commands that exited with 
+ * 0 are stored. Entries older than $DMSH_CACHE_AGE 
+ * (7d by default) are not used any more, objects 
+ * are evicted least recently used first once they 
+ * exceed $DMSH_CACHE_SIZE bytes (256M by default) 
+ * and entries go along with their object.
+ */
+namespace cache
+{
+    struct Hasher
+    {
+        uint64_t Lanes[2] = {0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL};
+
+        void update(const char *, size_t);
+        void update(const std::string &);
+        std::string hex() const;
+    };
+
+    std::string storeDir();
+    std::string fingerprint(const std::string &);
+    std::string key(Block *, const std::vector<std::string> &, const std::vector<std::string> &);
+    bool lookup(const std::string &, std::string &, int &);
+    std::string store(const std::string &, const std::string &, int);
+    double maxAge();
+    long long maxSize();
+    void evict();
+    void count(bool);
+    int stats();
+    int clear();
+} // namespace cache
+
+/**
+ * The following namespace enforces the deadlines 
+ * of background jobs. A single thread sleeps in 
+ * poll over one timerfd per job and the pidfds 
+ * of its processes, so a watched job costs two 
+ * file descriptors and no wake ups until its 
+ * deadline passes or it exits.
+ */
+namespace watchdog
+{
+    struct Watch
+    {
+        pid_t Pgid;
+        int Timer;
+        double KillAfter;
+        bool Escalated;
+        std::vector<int> Pidfds;
+    };
+
+    std::mutex lock;
+    std::vector<Watch> watches;
+    // eventfd that wakes the thread up for a new watch
+    int wake = -1;
+
+    void add(pid_t, const std::vector<pid_t> &, const Limits &);
+    void loop();
+} // namespace watchdog
+
+/**
+ * The following namespace keeps the output of 
+ * background jobs while `jobs -c on` is set. 
+ * stdout and stderr of every stage of the job 
+ * go to one pipe, a single reader thread polls 
+ * the pipes of all jobs and appends to a ring 
+ * buffer per job (a memfd of $DMSH_JOB_BUFFER 
+ * bytes, 256 KiB by default) so a job never 
+ * waits on the terminal and only its newest 
+ * output is kept.
+ * 
+ * A job is known by the pid of its first stage, 
+ * the number the shell prints when it starts and 
+ * finishes. `jobs -o %n` prints what job n wrote 
+ * so far, `jobs -f %n` keeps streaming until it 
+ * ends or ^C is pressed.
+ */
+namespace capture
+{
+    struct Job
+    {
+        std::string Command;
+        std::vector<pid_t> Pids;
+        int Pipe;
+        int Memfd;
+        char *Ring;
+        size_t Size;
+        // Bytes written in total, the ring holds the last Size of them
+        uint64_t Total;
+    };
+
+    bool enabled = false;
+    std::mutex lock;
+    std::map<int, Job> jobs;
+    // eventfd that wakes the thread up for a new job
+    int wake = -1;
+    // eventfd the thread bumps after every read, followers wait on it
+    int fed = -1;
+
+    void add(const std::vector<pid_t> &, const std::string &, int);
+    bool finished(const Job &);
+    void release(int);
+    void loop();
+    int show(int, bool);
+} // namespace capture
+
+/**
+ * The following namespace is the event loop of 
+ * the shell. SIGINT and SIGCHLD are blocked and 
+ * read from a signalfd instead of running a 
+ * handler, so they are dealt with as ordinary 
+ * events. One epoll instance waits on:
+ * 
+ *  * stdin              ->  the lines typed / piped in
+ *  * the signalfd       ->  SIGINT, SIGCHLD
+ *  * a pidfd per child  ->  a background job finished
+ *    of the background jobs
+ * 
+ * The interactive shell blocks in readLine, a 
+ * finished job is reported right away (and the 
+ * prompt shown again). Scripts look at the 
+ * events between their commands. Builtins that 
+ * block (and the wait for a foreground job) go 
+ * through wait, so ^C reaches them too.
+ */
+namespace events
+{
+    struct Child
+    {
+        pid_t Pid;
+        // First pid of the job, the job is done with the last of its children
+        pid_t Leader;
+        bool Last;
+        std::string Command;
+    };
+
+    int epfd = -1;
+    int sigfd = -1;
+    sigset_t mask;
+    bool stdin_polled = false;
+    bool notify = false;
+    std::map<int, Child> children;
+    // Status of the last stage of the jobs that are still running
+    std::map<pid_t, int> job_status;
+    // Input read beyond the line that was returned
+    std::string pending;
+    std::string prompt;
+    bool prompted = false;
+    bool interrupted = false;
+    // Processes of the job in the foreground, ^C is passed on to them
+    std::vector<pid_t> foreground;
+
+    void setup(bool);
+    void unblock();
+    void watch(const std::vector<pid_t> &, const std::string &);
+    void reaped(int);
+    void dispatch(int);
+    int wait(std::vector<struct pollfd> &, double);
+    int readable(int);
+    int readLine(std::string &, const std::string &);
+} // namespace events
+
+/**
+ * The following namespace loads the startup file 
+ * ($DMSH_RC, ~/.dmshrc by default). The tables it 
+ * leaves behind (variables, exports, aliases and 
+ * compiled functions) are written to a binary 
+ * snapshot in the cache directory:
+ * 
+ *  rc-<hash of the rc path>.snap
+ *    |-- Header   ->  magic, rc mtime / size / hash,
+ *    |                hash of the variables it reads
+ *    |-- names of the variables the rc reads
+ *    |-- vars, exports, aliases, functions (IR)
+ * 
+ * Later shells mmap the snapshot and install the 
+ * tables without parsing the rc again. A changed 
+ * mtime with an unchanged content hash keeps the 
+ * snapshot. Only an rc that just defines things 
+ * is snapshotted, one that runs other commands 
+ * is run again by every shell.
+ */
+namespace snapshot
+{
+    // Bump along with any change of the layout or of the IR
+    const uint32_t VERSION = 3;
+
+    struct Header
+    {
+        char Magic[8];
+        uint32_t Version;
+        int64_t MtimeSec;
+        int64_t MtimeNsec;
+        int64_t Size;
+        char RcHash[32];
+        char EnvHash[32];
+    };
+
+    struct Writer
+    {
+        std::string Buff;
+
+        void u64(uint64_t);
+        void str(const std::string &);
+        void strs(const std::vector<std::string> &);
+        void table(const std::map<std::string, std::string> &);
+        void command(const Command *);
+        void program(const Program *);
+    };
+
+    struct Reader
+    {
+        const char *Pos;
+        const char *End;
+        bool Ok;
+
+        uint64_t u64();
+        std::string str();
+        std::vector<std::string> strs();
+        std::map<std::string, std::string> table();
+        Command *command();
+        std::shared_ptr<Program> program();
+    };
+
+    std::string rcPath();
+    std::string path(const std::string &);
+    std::vector<std::string> references(const std::string &);
+    std::string envHash(const std::vector<std::string> &);
+    bool pure(const Program *);
+    bool load(const std::string &, const struct stat &);
+    void save(const std::string &, const struct stat &, const std::string &);
+    void startup();
+} // namespace snapshot
+
 /**
  *               ----------------
  *               MAIN EVENT LOOP
@@ -243,45 +924,136 @@ namespace parser
  * 
  * 1. We start by setting up the global  environment 
  *    variables. Followed by we initialize the event
- *    handler for SIGINT interrupt.
+ *    loop that receives SIGINT and SIGCHLD.
  * 
  * 2. Set up the prompt that willl appear showin the 
  *    current directory we are present
  * 
  * 3. within an infinite loop we take in command from
- *    the user in the form of std::string and send it
- *    to the parser for further processing
+ *    the user (waiting in the event loop, which also 
+ *    reports finished background jobs while the user 
+ *    types) in the form of std::string and send it
+ *    to the compiler for further processing. Lines are
+ *    collected until every if / for / while / function
+ *    is closed.
  * 
- * 4. The   parser  will  return  a  command  object. This 
- *    command is then send for execution to  the  function
+ * 4. The  compiler  will  return  a  program  object. This 
+ *    program is then send for execution to  the  function
  *    provided in the namespace executors for the handling 
- *    of the execution of this command object.
+ *    of the execution of this program object.
  * 
  * 5. Once the process if finished execution the loop repeats
+ * 
+ * Invoked as `dmsh FILE [ARGS]` or `dmsh -c STRING` the whole 
+ * source  is  compiled  at  once, run and the shell exits with 
+ * the status of the last command.
+ * 
+ * In every mode the startup file is loaded first, from its 
+ * snapshot when the rc did not change (see snapshot).
  */
 
 int main(int argc, char *argv[], char *envp[])
 {
-    std::string cmd;
+    std::string cmd, source;
 
     int i = 0;
     while (envp[i] != NULL)
         global_envp.push_back(envp[i++]);
 
-    signal(SIGINT, utility::signal_callback_handler);
+    events::setup(argc == 1 && isatty(STDIN_FILENO));
     setenv("PS1", "$ ", 0);
+    if (isatty(STDIN_FILENO))
+        tty_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
     // 0 --> Don't replace already existing value
 
+    snapshot::startup();
+
+    compiler::State state;
+    std::string error;
+
+    if (argc > 1)
+    {
+        if (std::string(argv[1]) == "-c" && argc > 2)
+        {
+            source = argv[2];
+            positional[0].assign(argv + 3, argv + argc);
+        }
+        else
+        {
+            std::ifstream script(argv[1]);
+            if (!script)
+            {
+                perror(argv[1]);
+                return 127;
+            }
+            std::stringstream buff;
+            buff << script.rdbuf();
+            source = buff.str();
+            positional[0].assign(argv + 2, argv + argc);
+        }
+
+        Program *program = compiler::Compile(source, state, error);
+        if (state != compiler::COMPLETE)
+        {
+            std::cerr << "dmsh: syntax error: " << error << std::endl;
+            return 2;
+        }
+        executors::run(program, true);
+        delete program;
+        return last_status;
+    }
+
+    // No prompt when the commands are piped in
+    bool interactive = isatty(STDIN_FILENO);
+
     while (true)
     {
-        std::cout << utility::getPrompt() << std::flush;
-        std::getline(std::cin, cmd);
+        int got = events::readLine(cmd, !interactive ? "" : source.empty() ? utility::getPrompt() : "> ");
+        if (got == 0)
+            break;
+        if (got == -1)
+        {
+            // ^C drops the statement that was being typed
+            source.clear();
+            continue;
+        }
+
+        source += cmd + "\n";
+        if (!compiler::isComplete(source))
+            continue;
+
+        Program *program = compiler::Compile(source, state, error);
+        if (state == compiler::INCOMPLETE)
+            continue;
+        if (state == compiler::ERROR)
+        {
+            std::cerr << "dmsh: syntax error: " << error << std::endl;
+            source.clear();
+            continue;
+        }
+
+        executors::run(program);
+
+        if (source.find("history") != std::string::npos)
+        {
+            delete program;
+            source.clear();
+            continue;
+        }
+        source.clear();
 
-        Command *command = parser::Parse(cmd);
-        if (cmd.find("history") == std::string::npos)
-            queue.push_back(command);
-        executors::execute(command);
+        // Keep the history bounded, the oldest program is released
+        queue.push_back(program);
+        if (queue.size() > HISTORY_LIMIT)
+        {
+            delete queue.front();
+            queue.erase(queue.begin());
+        }
     }
+
+    for (auto &program : queue)
+        delete program;
+    return last_status;
 }
 
 /******************************
@@ -291,32 +1063,41 @@ int main(int argc, char *argv[], char *envp[])
  ******************************/
 
 /**
- * Following function is a signal handler for CTRL+C 
- * signal which raises a SIGINT interrupt. When this 
- * interrupt is raised all the running process  must 
- * be stopped and the normal execution of the  shell 
- * must be resumed.
- * 
- * For  the  we send a SIGTERM signal that is terminate 
- * the running program signal along with the pid of the 
- * job that needs to be killed.
+ * Following function handles the CTRL+C signal 
+ * which raises a SIGINT interrupt. The SIGINT is 
+ * passed on to the job in the foreground, the 
+ * background jobs keep running and the normal 
+ * execution of the shell is resumed.
  * 
- * Once all the running jobs are killed return to the 
- * normal execution of the shell.
+ * SIGINT arrives through the signalfd of the event 
+ * loop, so this runs as ordinary code and not in 
+ * signal context.
  */
 
-void utility::signal_callback_handler(int signum)
+void utility::interrupt()
 {
-    int status;
-    pid_t cpid;
-    for (auto &proc : running_jobs)
+    // Last stage first, so it cannot see EOF from an earlier
+    // stage that is already gone and exit normally
+    for (auto it = events::foreground.rbegin(); it != events::foreground.rend(); ++it)
+        kill(*it, SIGINT);
+    // The foreground job is reaped by whoever waits for it
+    std::cout << std::endl;
+}
+
+/**
+ * Following function collects the background 
+ * jobs that have finished so that they do not 
+ * linger as zombies. It never blocks.
+ */
+void utility::reapJobs()
+{
+    for (auto it = running_jobs.begin(); it != running_jobs.end();)
     {
-        kill(proc, SIGTERM);
-        cpid = waitpid(proc, &status, 0);
+        if (waitpid(*it, NULL, WNOHANG) != 0)
+            it = running_jobs.erase(it);
+        else
+            ++it;
     }
-    std::cout << std::endl
-              << "Stopped all processes!!" << std::endl;
-    return;
 }
 
 /**
@@ -332,10 +1113,13 @@ void utility::signal_callback_handler(int signum)
 
 std::string utility::getPrompt()
 {
+    const char *user_env = getenv("USER");
+    char *cwd = getcwd(nullptr, 0);
 
     std::string ps1(getenv("PS1"));
-    std::string user(getenv("USER"));
-    std::string dir(getcwd(nullptr, 0));
+    std::string user(user_env ? user_env : "");
+    std::string dir(cwd ? cwd : "");
+    free(cwd);
     return "\033[1;32m" + user + ":" + "\033[1;31m" + dir + " " + ps1 + "\033[0m";
 }
 
@@ -346,8 +1130,12 @@ std::string utility::getPrompt()
  * the functions provided by the kernel like 
  * execvpe that requre the arguments in  the
  * for of traditional char** 
+ *
+ * The returned array must be released with
+ * free(), the strings themselves belong to
+ * the arguments passed in.
  */
-char **utility::strToChrArr(std::string prog, const std::vector<std::string> &args)
+char **utility::strToChrArr(const std::string &prog, const std::vector<std::string> &args)
 {
     char **Args = (char **)malloc((args.size() + 2) * sizeof(char *));
     Args[0] = (char *)prog.c_str();
@@ -369,6 +1157,8 @@ char **utility::strToChrArr(std::string prog, const std::vector<std::string> &ar
  * that  take  environment variables in 
  * the traditional char**  format  like
  * >>> execvpe(_ , _ , char** envs)
+ *
+ * Release the result with freeEnvArr
  */
 char **utility::constructEnvArr(std::map<std::string, std::string> env)
 {
@@ -392,96 +1182,565 @@ char **utility::constructEnvArr(std::map<std::string, std::string> env)
 }
 
 /**
- * The following function handles  the 
- * execution of the builtin change dir
- * function   using  the  `chdir`  api
- * provided  by  the  kernel.
- *   
- * If  no  argument is provided it is 
- * assumed that the directry is to be 
- * changed  to  the `HOME`  directory 
- * of the user denoted by '~'.
- * 
- * Otherwise change to the directory
- * provided in the argument.
+ * Releases the array built by constructEnvArr
+ * along with every string that it points to
  */
+void utility::freeEnvArr(char **envarr)
+{
+    for (int i = 0; envarr[i] != NULL; i++)
+        delete[] envarr[i];
+    delete[] envarr;
+}
 
-int builtin::cd(std::vector<std::string> &args)
+/**
+ * Following function resolves the value of a 
+ * variable  by  name.  Special parameters and 
+ * the positional arguments are looked up first,
+ * then the shell variables  and  finally  the 
+ * environment that is passed to the children.
+ * Unknown variables expand to ""
+ */
+std::string utility::lookupVar(const std::string &name)
 {
-    int exec_status;
-    if (args.empty())
+    const std::vector<std::string> &args = positional.back();
+    if (name == "?")
+        return std::to_string(last_status);
+    if (name == "#")
+        return std::to_string(args.size());
+    if (name == "@" || name == "*")
     {
-        std::string new_dir = "/home/" + std::string(getenv("USER"));
-        exec_status = chdir(new_dir.c_str());
+        std::string joined;
+        for (auto &arg : args)
+            joined += (joined.empty() ? "" : " ") + arg;
+        return joined;
     }
-    else if (args[0][0] == '~')
+    if (isdigit(name[0]))
     {
-        std::string new_dir = "/home/" + std::string(getenv("USER"));
-        new_dir = new_dir + args[0].substr(1);
-        exec_status = chdir(new_dir.c_str());
+        size_t n = atoi(name.c_str());
+        if (n == 0)
+            return "dmsh";
+        return n <= args.size() ? args[n - 1] : "";
     }
-    else
+
+    auto it = shell_vars.find(name);
+    if (it != shell_vars.end())
+        return it->second;
+
+    for (auto &env : global_envp)
     {
-        exec_status = chdir(args[0].c_str());
-        if (exec_status)
-            perror("cd");
+        if (strncmp(env, name.c_str(), name.length()) == 0 && env[name.length()] == '=')
+            return env + name.length() + 1;
     }
-    return exec_status;
-}
-
-int builtin::help(std::vector<std::string> &args)
-{
-    std::cout << "\
-    BUILTIN COMMANDS\n\
-    ----------------\n\
-    cd [OPTIONAL Path]             : change directory to the given path\n\
-    exit                           : Exit from the shell. Stops all running processes\n\
-    info                           : Info about the authors\n\
-    export [CLAUSE] [OPTIONAL]     : Export environment variables\n\
-    history [NUMBER]               : Execute N th from the last command"
-              << std::endl;
-    return 0;
+    return "";
 }
 
 /**
- * The following  function  is 
- * used to execute  the  [N]th 
- * command from the  last.  It 
- * pulls out the command  from
- * the command queue and  then
- * executes the program  using 
- * the command helper function
+ * The following function substitutes $NAME, 
+ * ${NAME} and the special parameters $?, $#,
+ * $@ and $0-$9 inside of the  given  string.
+ * A $ that  does not start a  variable  name 
+ * is left untouched.
  */
-int builtin::history(std::vector<std::string> &args)
+std::string utility::expand(const std::string &str)
 {
-    int n = atoi(args[0].c_str());
-    if (n > queue.size())
-        return 1;
-    executors::execute(queue[queue.size() - n]);
-    return 0;
-}
+    size_t pos = str.find('$');
+    if (pos == std::string::npos)
+        return str;
 
-/**
- * The  following  funtion  handles  the 
- * execution of exit command  using  the 
- * exit api provided by processes module
- * 
- * Before exiting from the dshell all  the
- * currently    running   process,    both
- * backgropund and the  foreground   needs 
- * to be terminated.  Following that  exit 
- * from the terminal and the  exit  status 
- * will be the error status (if any) while
- * terminating the running tasks
- */
-int builtin::exit(std::vector<std::string> &args)
-{
-    int status;
-    pid_t cpid;
-    for (auto &proc : running_jobs)
+    std::string result = str.substr(0, pos);
+    while (pos < str.length())
+    {
+        if (str[pos] != '$' || pos + 1 == str.length())
+        {
+            result += str[pos++];
+            continue;
+        }
+
+        size_t start = pos + 1, end;
+        std::string name;
+        if (str[start] == '{')
+        {
+            end = str.find('}', start);
+            if (end == std::string::npos)
+            {
+                result += str[pos++];
+                continue;
+            }
+            name = str.substr(start + 1, end - start - 1);
+            end++;
+        }
+        else if (strchr("?#@*", str[start]) || isdigit(str[start]))
+        {
+            name = str.substr(start, 1);
+            end = start + 1;
+        }
+        else
+        {
+            end = start;
+            while (end < str.length() && (isalnum(str[end]) || str[end] == '_'))
+                end++;
+            name = str.substr(start, end - start);
+        }
+
+        if (name.empty())
+        {
+            result += str[pos++];
+            continue;
+        }
+        result += lookupVar(name);
+        pos = end;
+    }
+    return result;
+}
+
+/**
+ * Tells whether any  atom  of  the block 
+ * refers to a variable and has to be ex-
+ * -panded before it is executed.
+ */
+bool utility::needsExpansion(const Block *b)
+{
+    auto hasVar = [](const std::string &str) { return str.find('$') != std::string::npos; };
+    for (auto &atom : b->Atoms)
+    {
+        if (hasVar(atom->Program) || hasVar(atom->InputStream) || hasVar(atom->OutputStream))
+            return true;
+        for (size_t i = 0; i < atom->Args.size(); i++)
+            if (hasVar(atom->Args[i]) && !utility::isLiteral(atom, i))
+                return true;
+        for (auto &var : atom->RuntimeVars)
+            if (hasVar(var.second) && var.second[0] != '\'')
+                return true;
+    }
+    return false;
+}
+
+/**
+ * Builds a copy  of  the  atom  with  all 
+ * variables  expanded,  the  parsed atom 
+ * itself is never modified so  that  the 
+ * compiled program can be run again.
+ * 
+ * A "$@" argument expands to one argument
+ * per positional parameter.
+ */
+Atom *utility::expandAtom(const Atom *a)
+{
+    Atom *atom = new Atom();
+    atom->Program = expand(a->Program);
+    atom->InputStream = expand(a->InputStream);
+    atom->OutputStream = expand(a->OutputStream);
+    atom->OutputMode = a->OutputMode;
+    atom->HereString = a->HereString;
+    // The value of X='...' still holds its quotes
+    for (auto &var : a->RuntimeVars)
+        atom->RuntimeVars[var.first] = var.second[0] == '\'' ? var.second : expand(var.second);
+    for (size_t i = 0; i < a->Args.size(); i++)
+    {
+        if (isLiteral(a, i))
+            atom->Args.push_back(a->Args[i]);
+        else if (a->Args[i] == "$@")
+            atom->Args.insert(atom->Args.end(), positional.back().begin(), positional.back().end());
+        else
+            atom->Args.push_back(expand(a->Args[i]));
+    }
+    // The expanded words are final, a prefix that runs the block again must not expand them twice
+    atom->Literal.assign(atom->Args.size(), true);
+    return atom;
+}
+
+// Whether argument i of the atom was single quoted
+bool utility::isLiteral(const Atom *a, size_t i)
+{
+    return i < a->Literal.size() && a->Literal[i];
+}
+
+/**
+ * Expands the word list of a for loop. Words
+ * that were single quoted are kept as they are, 
+ * the others holding variables are split at 
+ * whitespace,
+ * "$@" gives the positional  parameters  and
+ * {A..B} gives the integers from A to B.
+ */
+std::vector<std::string> utility::expandWords(const std::vector<std::string> &words, const std::vector<bool> &literal)
+{
+    static const std::regex rangeRgx("\\{(-?[0-9]+)\\.\\.(-?[0-9]+)\\}");
+    std::vector<std::string> result;
+    std::smatch range;
+
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        const std::string &word = words[i];
+        if (i < literal.size() && literal[i])
+        {
+            result.push_back(word);
+        }
+        else if (word == "$@")
+        {
+            result.insert(result.end(), positional.back().begin(), positional.back().end());
+        }
+        else if (std::regex_match(word, range, rangeRgx))
+        {
+            long from = atol(range[1].str().c_str()), to = atol(range[2].str().c_str());
+            long step = from <= to ? 1 : -1;
+            for (long n = from; n != to + step; n += step)
+                result.push_back(std::to_string(n));
+        }
+        else if (word.find('$') != std::string::npos)
+        {
+            std::istringstream split(expand(word));
+            std::string w;
+            while (split >> w)
+                result.push_back(w);
+        }
+        else
+        {
+            result.push_back(word);
+        }
+    }
+    return result;
+}
+
+/**
+ * The following function moves everything that 
+ * can be read from in to out, picking the least 
+ * copying kernel api for the two file types:
+ * 
+ * * file -> file  :  copy_file_range (not
+ *                   for an O_APPEND out)
+ * * pipe on either side  :  splice
+ * * file -> other :  sendfile
+ * * otherwise  :  read / write through a buffer
+ * 
+ * When the kernel refuses the zero copy call 
+ * for the given descriptors (EINVAL, EXDEV, ...) 
+ * before anything was moved, or none applies 
+ * (a terminal, /dev/null), the buffered copy 
+ * is used. Returns the number of bytes moved 
+ * or -1 on error (errno EINTR after a ^C).
+ */
+long long utility::copyFd(int in, int out)
+{
+    const size_t chunk = 1 << 20;
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) == -1 || fstat(out, &out_st) == -1)
+        return -1;
+
+    long long total = 0;
+    ssize_t n = -1;
+    // Whether a zero copy call ran, errno means nothing otherwise
+    bool tried = true;
+    // copy_file_range fails an O_APPEND out (>>) with EBADF
+    bool appending = (fcntl(out, F_GETFL) & O_APPEND) != 0;
+    bool in_file = S_ISREG(in_st.st_mode), out_file = S_ISREG(out_st.st_mode) && !appending;
+    bool in_pipe = S_ISFIFO(in_st.st_mode), out_pipe = S_ISFIFO(out_st.st_mode);
+
+    if (in_file && out_file)
+    {
+        while ((n = copy_file_range(in, NULL, out, NULL, chunk, 0)) > 0)
+            total += n;
+    }
+    else if (in_pipe || out_pipe)
+    {
+        while ((n = events::readable(in)) == 0 && (n = splice(in, NULL, out, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+            total += n;
+    }
+    else if (in_file)
+    {
+        while ((n = sendfile(out, in, NULL, chunk)) > 0)
+            total += n;
+    }
+    else
+        tried = false;
+
+    if (tried && n == 0)
+        return total;
+    if (tried && (total > 0 || (errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)))
+        return -1;
+
+    // Buffered fallback
+    std::vector<char> buff(1 << 17);
+    while ((n = events::readable(in)) == 0 && (n = read(in, buff.data(), buff.size())) > 0)
+    {
+        for (ssize_t done = 0; done < n;)
+        {
+            ssize_t w = write(out, buff.data() + done, n - done);
+            if (w == -1)
+                return -1;
+            done += w;
+        }
+        total += n;
+    }
+    return n == 0 ? total : -1;
+}
+
+/**
+ * Monotonic clock in seconds, used for the 
+ * timings of the pipestat report.
+ */
+double utility::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * The following function reads the counters of 
+ * an exited but not yet reaped child: the bytes 
+ * from /proc/<pid>/io and the time  spent  on 
+ * and waiting for a cpu from /proc/<pid>/schedstat.
+ * 
+ * Wall must already be set, Blocked is derived 
+ * as Wall minus the running and runnable time.
+ */
+void utility::sampleStage(pid_t pid, StageStat &stat)
+{
+    std::string proc = "/proc/" + std::to_string(pid);
+    std::ifstream io(proc + "/io");
+    std::string key;
+    long long value;
+    while (io >> key >> value)
+    {
+        if (key == "rchar:")
+            stat.ReadBytes = value;
+        else if (key == "wchar:")
+            stat.WriteBytes = value;
+    }
+
+    std::ifstream sched(proc + "/schedstat");
+    long long run_ns, wait_ns;
+    if (sched >> run_ns >> wait_ns)
+        stat.Blocked = std::max(0.0, stat.Wall - (run_ns + wait_ns) / 1e9);
+}
+
+/**
+ * Following function prints the  pipestat 
+ * report of a block to stderr, one line per 
+ * atom in pipeline order.
+ */
+void utility::printPipestat(const std::vector<StageStat> &stats)
+{
+    auto known = [](long long n) { return n < 0 ? std::string("-") : std::to_string(n); };
+
+    std::cerr << std::fixed << std::setprecision(3)
+              << "pipestat:" << std::endl
+              << std::left << std::setw(4) << "  #" << std::setw(21) << "command"
+              << std::right << std::setw(10) << "wall(s)" << std::setw(10) << "cpu(s)"
+              << std::setw(12) << "blocked(s)" << std::setw(12) << "maxrss(KB)"
+              << std::setw(14) << "read(B)" << std::setw(14) << "written(B)" << std::endl;
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        const StageStat &st = stats[i];
+        std::cerr << std::left << "  " << std::setw(2) << i << std::setw(21) << st.Name.substr(0, 20)
+                  << std::right << std::setw(10) << st.Wall << std::setw(10) << st.Cpu
+                  << std::setw(12) << st.Blocked << std::setw(12) << known(st.MaxRss)
+                  << std::setw(14) << known(st.ReadBytes) << std::setw(14) << known(st.WriteBytes) << std::endl;
+    }
+    std::cerr.unsetf(std::ios::floatfield | std::ios::adjustfield);
+    std::cerr << std::setprecision(6);
+}
+
+/**
+ * Following function parses a duration like 
+ * 1.5, 30s, 2m, 1h or 1d into seconds.
+ */
+bool utility::parseDuration(const std::string &str, double &seconds)
+{
+    char *end;
+    double n = strtod(str.c_str(), &end);
+    std::string suffix(end);
+    if (str.empty() || end == str.c_str() || n < 0 || suffix.length() > 1 || (!suffix.empty() && !strchr("smhd", suffix[0])))
+        return false;
+    seconds = n * (suffix == "m" ? 60 : suffix == "h" ? 3600 : suffix == "d" ? 86400 : 1);
+    return true;
+}
+
+/**
+ * Following function parses a size like 4096, 
+ * 512K, 100M or 2G into bytes.
+ */
+bool utility::parseSize(const std::string &str, long long &bytes)
+{
+    char *end;
+    double n = strtod(str.c_str(), &end);
+    std::string suffix(end);
+    if (str.empty() || end == str.c_str() || n < 0 || suffix.length() > 1 || (!suffix.empty() && !strchr("KkMmGg", suffix[0])))
+        return false;
+    int shift = suffix.empty() ? 0 : tolower(suffix[0]) == 'k' ? 10 : tolower(suffix[0]) == 'm' ? 20 : 30;
+    bytes = (long long)(n * (1LL << shift));
+    return true;
+}
+
+/**
+ * The following function adds NAME=VALUE to the 
+ * environment of the children. The string is 
+ * owned by exported_env, re-exporting a name 
+ * replaces the entry instead of adding one.
+ */
+void utility::exportVar(const std::string &buff)
+{
+    std::string name = buff.substr(0, buff.find('='));
+    std::string &entry = exported_env[name];
+    entry = buff;
+
+    auto it = std::find_if(global_envp.begin(), global_envp.end(), [&](char *env) {
+        return strncmp(env, name.c_str(), name.length()) == 0 && env[name.length()] == '=';
+    });
+    if (it != global_envp.end())
+        *it = (char *)entry.c_str();
+    else
+        global_envp.push_back((char *)entry.c_str());
+}
+
+// Arms the one shot timerfd to expire after seconds
+void utility::armTimer(int fd, double seconds)
+{
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = (time_t)seconds;
+    spec.it_value.tv_nsec = (long)((seconds - spec.it_value.tv_sec) * 1e9);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;
+    timerfd_settime(fd, 0, &spec, NULL);
+}
+
+/**
+ * The following function is called when the 
+ * deadline timer of a job expires. The first 
+ * time the whole process group gets SIGTERM 
+ * and the timer is re-armed for the grace 
+ * period, after that it gets SIGKILL.
+ */
+void utility::escalate(pid_t pgid, int timer, bool &escalated, double grace)
+{
+    uint64_t expirations;
+    if (read(timer, &expirations, sizeof(expirations)) == -1)
+        return;
+
+    if (!escalated)
+    {
+        kill(-pgid, SIGTERM);
+        escalated = true;
+        armTimer(timer, grace);
+    }
+    else
+    {
+        kill(-pgid, SIGKILL);
+    }
+}
+
+/**
+ * The following function handles  the 
+ * execution of the builtin change dir
+ * function   using  the  `chdir`  api
+ * provided  by  the  kernel.
+ *   
+ * If  no  argument is provided it is 
+ * assumed that the directry is to be 
+ * changed  to  the `HOME`  directory 
+ * of the user denoted by '~'.
+ * 
+ * Otherwise change to the directory
+ * provided in the argument.
+ */
+
+int builtin::cd(std::vector<std::string> &args)
+{
+    int exec_status;
+    if (args.empty())
+    {
+        std::string new_dir = "/home/" + std::string(getenv("USER"));
+        exec_status = chdir(new_dir.c_str());
+    }
+    else if (args[0][0] == '~')
+    {
+        std::string new_dir = "/home/" + std::string(getenv("USER"));
+        new_dir = new_dir + args[0].substr(1);
+        exec_status = chdir(new_dir.c_str());
+    }
+    else
+    {
+        exec_status = chdir(args[0].c_str());
+        if (exec_status)
+            perror("cd");
+    }
+    return exec_status == 0 ? 0 : 1;
+}
+
+int builtin::help(std::vector<std::string> &args)
+{
+    std::cout << "\
+    BUILTIN COMMANDS\n\
+    ----------------\n\
+    cd [OPTIONAL Path]             : change directory to the given path\n\
+    exit [STATUS]                  : Exit from the shell. Stops all running processes\n\
+    info                           : Info about the authors\n\
+    export [CLAUSE] [OPTIONAL]     : Export environment variables\n\
+    alias [NAME[=VALUE]] / unalias : Define / list / remove aliases\n\
+    history [NUMBER]               : Execute N th from the last command\n\
+    echo [-n] [-e] [ARGS]          : Write the arguments to the output\n\
+    printf FORMAT [ARGS]           : Write the arguments formatted by FORMAT\n\
+    true / false                   : Return a successful / unsuccessful status\n\
+    test EXPR / [ EXPR ]           : Evaluate a conditional expression\n\
+    pwd                            : Print the current working directory\n\
+    sleep SECONDS                  : Pause for the given time\n\
+    cat [FILES]                    : Copy the files (or stdin) to the output\n\
+    tee [-a] [FILES]               : Copy stdin to the output and to the files\n\
+    enable [-n] [NAME]             : Enable / disable (-n) builtins, list them\n\
+    enable -f FILE.so NAME / -d    : Load the builtin NAME from FILE.so / remove it\n\
+    xargs [-0] [-P N] [-n MAX] CMD : Run CMD with the words of stdin, in as few\n\
+                                     invocations as ARG_MAX allows, N at a time\n\
+    pipestat [on|off]              : Report per stage statistics after each block\n\
+    optimize [PASS|trace] [on|off] : Switch the pipeline rewrites / their report\n\
+    jobs [-c on|off]               : List the captured background jobs / capture them\n\
+    jobs -o %N / -f %N             : Print / stream the captured output of job N\n\
+    exec [CMD [ARGS]]              : Replace the shell by CMD / keep < and > for it\n\
+    cached [-i FILE] [-e VAR] CMD  : Replay the output of CMD while its inputs are unchanged\n\
+    cached --stats / --clear       : Show the hit rate of / empty the cache\n\
+    timeout [-k KILL] [-c CPU]     : Stop CMD after DURATION (SIGTERM, SIGKILL after KILL)\n\
+            [-m MEM] DURATION CMD    with at most CPU seconds and MEM bytes of memory"
+              << std::endl;
+    return 0;
+}
+
+/**
+ * The following  function  is 
+ * used to execute  the  [N]th 
+ * command from the  last.  It 
+ * pulls out the command  from
+ * the command queue and  then
+ * executes the program  using 
+ * the command helper function
+ */
+int builtin::history(std::vector<std::string> &args)
+{
+    int n = args.empty() ? 1 : atoi(args[0].c_str());
+    if (n < 1 || n > queue.size())
+        return 1;
+    return executors::run(queue[queue.size() - n]);
+}
+
+/**
+ * The  following  funtion  handles  the 
+ * execution of exit command  using  the 
+ * exit api provided by processes module
+ * 
+ * Before exiting from the dshell all  the
+ * currently    running   process,    both
+ * backgropund and the  foreground   needs 
+ * to be terminated.  Following that  exit 
+ * from the terminal and the  exit  status 
+ * will be the error status (if any) while
+ * terminating the running tasks
+ */
+int builtin::exit(std::vector<std::string> &args)
+{
+    int status = args.empty() ? last_status : atoi(args[0].c_str());
+    for (auto &proc : running_jobs)
     {
         kill(proc, SIGTERM);
-        cpid = waitpid(proc, &status, 0);
+        waitpid(proc, NULL, 0);
     }
     std::exit(status);
     return status;
@@ -504,7 +1763,7 @@ int builtin::exportEnv(std::vector<std::string> &args)
             buff += args[i];
         }
 
-        global_envp.push_back((char *)buff.c_str());
+        utility::exportVar(buff);
         std::cout << buff << std::endl;
     }
     catch (...)
@@ -514,6 +1773,69 @@ int builtin::exportEnv(std::vector<std::string> &args)
     return 0;
 }
 
+/**
+ * The following function defines the aliases 
+ * given as NAME=VALUE, prints the ones given 
+ * as NAME and lists all of them without any 
+ * argument. A quoted value is split off its 
+ * NAME= by the parser, so the two are joined 
+ * back here (as export does).
+ */
+int builtin::alias(std::vector<std::string> &args)
+{
+    if (args.empty())
+    {
+        for (auto &entry : aliases)
+            std::cout << "alias " << entry.first << "='" << entry.second << "'" << std::endl;
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        std::string def = args[i];
+        if (def.back() == '=' && i + 1 < args.size())
+            def += args[++i];
+
+        size_t eq = def.find('=');
+        if (eq != std::string::npos && eq > 0)
+        {
+            aliases[def.substr(0, eq)] = def.substr(eq + 1);
+            continue;
+        }
+
+        auto it = aliases.find(def);
+        if (it != aliases.end())
+            std::cout << "alias " << it->first << "='" << it->second << "'" << std::endl;
+        else
+        {
+            std::cerr << "alias: " << def << ": not found" << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int builtin::unalias(std::vector<std::string> &args)
+{
+    if (!args.empty() && args[0] == "-a")
+    {
+        aliases.clear();
+        return 0;
+    }
+
+    int status = 0;
+    for (auto &name : args)
+    {
+        if (aliases.erase(name) == 0)
+        {
+            std::cerr << "unalias: " << name << ": not found" << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
 /**
  * The following function is built just to 
  * provide information about the  projects 
@@ -556,439 +1878,4098 @@ int builtin::info(std::vector<std::string> &)
 }
 
 /**
- * The following function handles 
- * the execution of a single line
- * function that is stored a Atom 
- * object.
- * 
- * 1. Convert  the  args  to  char**
- * 2. Convert the env Vars to char**
- * 3. Fork to create a child process
- * 
- *    On succesful creation of the child
- *    process we get either 0 or the pid 
- *    of  the  child  process so created. 
- *    Wait teh child process  to  finish 
- *    execution.
+ * Following function returns the index of the 
+ * static builtin of the given name in the array 
+ * builtin_commands or -1. The name is hashed 
+ * into its slot and compared ignoring the case.
  */
-int executors::execSingleCmd(Atom *a, bool bg)
+int builtin::lookup(const std::string &prog)
 {
-    char **Args = utility::strToChrArr(a->Program, a->Args);
-    char **Envs = utility::constructEnvArr(a->RuntimeVars);
+    int index = slots.Index[hashName(prog.data(), prog.length(), hash_seed)];
+    if (index == -1 || strcasecmp(builtin_commands[index].Name, prog.c_str()) != 0)
+        return -1;
+    return index;
+}
 
-    if (strlen(Args[0]) == 0)
-        return 0;
+// Lower case form of a builtin name, the key of disabled
+std::string builtin::normalize(const std::string &name)
+{
+    std::string result = name;
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return tolower(c); });
+    return result;
+}
 
-    int pid = fork(), status;
-    if (pid == 0)
-    {
-        running_jobs.push_back(getpid());
-        if (bg)
-            setpgid(0, 0);
-        status = execvpe(Args[0], Args, Envs);
-        if (status == -1)
-        {
-            perror(strerror(errno));
-        }
-        return errno;
-    }
-    else
+/**
+ * Following function looks up the builtin 
+ * of the given name. The builtins  loaded 
+ * with `enable -f` take precedence over the 
+ * static ones. Returns nullptr if there is 
+ * no such (enabled) builtin.
+ */
+builtin::Function builtin::find(const std::string &prog)
+{
+    if (!disabled.empty() && disabled.count(normalize(prog)))
+        return nullptr;
+
+    if (!loaded.empty())
     {
-        waitpid(pid, &status, 0);
+        auto it = loaded.find(normalize(prog));
+        if (it != loaded.end())
+            return it->second.first;
     }
-    return status;
+
+    int index = lookup(prog);
+    return index == -1 ? nullptr : builtin_commands[index].Fn;
 }
 
 /**
- * Following function is the main handler 
- * of any execution  related to statement 
- * stored  as  an  atom, that is the most 
- * basic command  in the shell.
- * 
- * For this we  find  whether  the  program 
- * is part of any of the predefined builtin
- * functions. If so then send the program to 
- * the builtin function handler for further 
- * execution.
+ * The following function loads the builtin name 
+ * from the shared object at path. The object 
+ * has to export the function
  * 
- * Otherwise make use of the single command 
- * handler utility provided in the executor
- * namespace defined. 
+ *  >>> extern "C" int dmsh_builtin_<name>(std::vector<std::string> &args);
  * 
- * Boolean type bg menstions whether the 
- * program  should   be  sent  into  the 
- * background for running
+ * which is called in-process like any other 
+ * builtin: args holds the arguments, what it 
+ * writes to std::cout / stdout goes where the 
+ * block redirects it and its return value is 
+ * the exit status.
  */
-int executors::execute_atom(Atom *a, bool bg)
+int builtin::load(const std::string &path, const std::string &name)
 {
-    int exec_val;
-    std::string cmd = a->Program;
-
-    transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
-    if (builtin::builtin_commands.find(cmd) != builtin::builtin_commands.end())
+    // A plain name would make dlopen search the library path only
+    std::string file = path.find('/') == std::string::npos ? "./" + path : path;
+    void *handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
     {
-        return builtin::builtin_commands[cmd](a->Args);
+        std::cerr << "enable: " << dlerror() << std::endl;
+        return 1;
     }
-    else
+
+    Function fn = (Function)dlsym(handle, ("dmsh_builtin_" + name).c_str());
+    if (fn == nullptr)
     {
-        exec_val = execSingleCmd(a, bg);
+        std::cerr << "enable: " << path << ": no symbol dmsh_builtin_" << name << std::endl;
+        dlclose(handle);
+        return 1;
     }
-    return exec_val;
+
+    // dlopen counts the references, a replaced builtin releases its own
+    auto it = loaded.find(normalize(name));
+    if (it != loaded.end())
+        dlclose(it->second.second);
+    loaded[normalize(name)] = {fn, handle};
+    return 0;
 }
 
 /**
- * Following function is the main  function 
- * for handling the execution of the  block 
- * level statements. Block level statements
- * may contain pipes, so pipes are  handled
- * as a part of this code.
- * 
- * all the atom  commands  that  are  contained
- * the current block are executed  sequentially
- * in a loop. In the loop the pipes are handled
- * where output from prvious iteration is  sent
- * to the next iteration atom command execution.
+ * The following function handles the builtin 
+ * echo. The arguments are written separated 
+ * by a single space.
  * 
- * For the last element of the loop no further
- * piping is required hence the input and out-
- * -put streams are set manually.
- * 
- * The execute_atom function handles the execution
- * of the atom commands. Finally restore the stdin 
- * file descriptor and the stdout file descriptor.  
+ * -n  ->  no trailing newline
+ * -e  ->  interpret \n, \t, \\ and \c (stop)
  */
-int executors::execute_block(Block *b)
+int builtin::echo(std::vector<std::string> &args)
 {
-    int stdin_copy = dup(STDIN_FILENO);
-    int stdout_copy = dup(STDOUT_FILENO);
-
-    int fdin;
-    // Redirections are only taken from the last command of the block
-    if (!b->Atoms[b->Atoms.size() - 1]->InputStream.empty())
+    bool newline = true, escapes = false;
+    size_t i = 0;
+    for (; i < args.size() && args[i].length() > 1 && args[i][0] == '-'; i++)
     {
-        fdin = open(b->Atoms[b->Atoms.size() - 1]->InputStream.c_str(), O_RDONLY);
+        if (args[i].find_first_not_of("ne", 1) != std::string::npos)
+            break;
+        newline = newline && args[i].find('n') == std::string::npos;
+        escapes = escapes || args[i].find('e') != std::string::npos;
     }
-    else
+
+    std::string out;
+    for (size_t j = i; j < args.size(); j++)
     {
-        fdin = dup(stdin_copy);
+        if (j > i)
+            out += ' ';
+        out += args[j];
     }
 
-    int fdout;
-
-    for (int i = 0; i < b->Atoms.size(); i++)
+    if (escapes)
     {
-        dup2(fdin, STDIN_FILENO);
-        close(fdin);
-
-        if (i == b->Atoms.size() - 1)
+        std::string raw = out;
+        out.clear();
+        for (size_t j = 0; j < raw.length(); j++)
         {
-            if (b->Atoms[i]->OutputStream.length() > 0)
+            if (raw[j] != '\\' || j + 1 == raw.length())
             {
-                FILE *out;
-                if (b->Atoms[i]->OutputMode == 1)
-                {
-                    out = fopen(b->Atoms[i]->OutputStream.c_str(), "w");
-                }
-                else
-                {
-                    out = fopen(b->Atoms[i]->OutputStream.c_str(), "a");
-                }
-                fdout = fileno(out);
+                out += raw[j];
+                continue;
             }
-            else
+            char c = raw[++j];
+            if (c == 'c')
             {
-                fdout = dup(stdout_copy);
+                newline = false;
+                break;
             }
+            out += c == 'n' ? '\n' : c == 't' ? '\t' : c == '\\' ? '\\' : c == 'a' ? '\a' : c;
+        }
+    }
+
+    if (newline)
+        out += '\n';
+    std::cout << out;
+    return 0;
+}
+
+int builtin::trueCmd(std::vector<std::string> &)
+{
+    return 0;
+}
+
+int builtin::falseCmd(std::vector<std::string> &)
+{
+    return 1;
+}
+
+/**
+ * The following function evaluates the  test 
+ * expression in args. Supported  are  the 
+ * negation '!', the string tests -z / -n / 
+ * = / !=, the integer comparisons  -eq, -ne, 
+ * -lt, -le, -gt, -ge and the file tests -e, 
+ * -f, -d, -s, -r, -w, -x, -L.
+ * 
+ * Returns 0 for true, 1 for false  and  2 
+ * for an invalid expression.
+ */
+int builtin::test(std::vector<std::string> &args)
+{
+    std::vector<std::string> expr(args);
+    bool negate = false;
+    while (!expr.empty() && expr[0] == "!" && expr.size() > 1)
+    {
+        negate = !negate;
+        expr.erase(expr.begin());
+    }
+
+    bool result;
+    struct stat st;
+    if (expr.empty())
+    {
+        result = false;
+    }
+    else if (expr.size() == 1)
+    {
+        result = !expr[0].empty();
+    }
+    else if (expr.size() == 2)
+    {
+        const std::string &op = expr[0], &arg = expr[1];
+        if (op == "-z")
+            result = arg.empty();
+        else if (op == "-n")
+            result = !arg.empty();
+        else if (op == "-L")
+            result = lstat(arg.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+        else if (op == "-r")
+            result = access(arg.c_str(), R_OK) == 0;
+        else if (op == "-w")
+            result = access(arg.c_str(), W_OK) == 0;
+        else if (op == "-x")
+            result = access(arg.c_str(), X_OK) == 0;
+        else if (op == "-e" || op == "-f" || op == "-d" || op == "-s")
+        {
+            result = stat(arg.c_str(), &st) == 0;
+            if (op == "-f")
+                result = result && S_ISREG(st.st_mode);
+            else if (op == "-d")
+                result = result && S_ISDIR(st.st_mode);
+            else if (op == "-s")
+                result = result && st.st_size > 0;
         }
         else
         {
-            int fdes[2];
-            int res = pipe(fdes);
-            if (res == -1)
+            std::cerr << "test: " << op << ": unary operator expected" << std::endl;
+            return 2;
+        }
+    }
+    else if (expr.size() == 3)
+    {
+        const std::string &lhs = expr[0], &op = expr[1], &rhs = expr[2];
+        if (op == "=" || op == "==")
+            result = lhs == rhs;
+        else if (op == "!=")
+            result = lhs != rhs;
+        else
+        {
+            char *end_l, *end_r;
+            long l = strtol(lhs.c_str(), &end_l, 10), r = strtol(rhs.c_str(), &end_r, 10);
+            if (lhs.empty() || rhs.empty() || *end_l || *end_r)
+            {
+                std::cerr << "test: integer expression expected" << std::endl;
+                return 2;
+            }
+            if (op == "-eq")
+                result = l == r;
+            else if (op == "-ne")
+                result = l != r;
+            else if (op == "-lt")
+                result = l < r;
+            else if (op == "-le")
+                result = l <= r;
+            else if (op == "-gt")
+                result = l > r;
+            else if (op == "-ge")
+                result = l >= r;
+            else
             {
-                perror("pipe");
-                exit(-1);
+                std::cerr << "test: " << op << ": binary operator expected" << std::endl;
+                return 2;
             }
-            fdout = fdes[1];
-            fdin = fdes[0];
         }
+    }
+    else
+    {
+        std::cerr << "test: too many arguments" << std::endl;
+        return 2;
+    }
+    return result != negate ? 0 : 1;
+}
 
-        dup2(fdout, STDOUT_FILENO);
-        close(fdout);
+/**
+ * Following function is the [ EXPR ] form of 
+ * test, the last argument has to be "]"
+ */
+int builtin::bracket(std::vector<std::string> &args)
+{
+    if (args.empty() || args.back() != "]")
+    {
+        std::cerr << "[: missing ']'" << std::endl;
+        return 2;
+    }
+    std::vector<std::string> expr(args.begin(), args.end() - 1);
+    return test(expr);
+}
 
-        execute_atom(b->Atoms[i], b->IsBackgroundProcess);
+/**
+ * The following function handles the builtin 
+ * printf. The FORMAT understands the escapes 
+ * \n, \t, \\ and the conversions %s, %b, %c, 
+ * %d, %i, %u, %o, %x, %X, %f, %e, %g and %% 
+ * along with their flags, width and precision.
+ * Anything else in a conversion (*, length 
+ * modifiers, %n) is rejected, so snprintf only 
+ * ever sees a spec matching its one argument.
+ * 
+ * Like the standalone program, the format is 
+ * reused as long as arguments are left over.
+ */
+int builtin::printfCmd(std::vector<std::string> &args)
+{
+    if (args.empty())
+    {
+        std::cerr << "printf: usage: printf FORMAT [ARGS]" << std::endl;
+        return 2;
     }
 
+    const std::string &format = args[0];
+    size_t next = 1;
     int status = 0;
-    if (!b->IsBackgroundProcess)
-        wait(&status);
-    else
-        std::cerr << "Command sent to background" << std::endl;
+    std::string out;
+    char buff[512];
 
-    dup2(stdin_copy, STDIN_FILENO);
-    dup2(stdout_copy, STDOUT_FILENO);
-    close(stdin_copy);
-    close(stdout_copy);
+    do
+    {
+        bool consumed = false;
+        for (size_t i = 0; i < format.length(); i++)
+        {
+            char c = format[i];
+            if (c == '\\' && i + 1 < format.length())
+            {
+                c = format[++i];
+                out += c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c == 'a' ? '\a' : c;
+                continue;
+            }
+            if (c != '%')
+            {
+                out += c;
+                continue;
+            }
+            if (i + 1 < format.length() && format[i + 1] == '%')
+            {
+                out += '%';
+                i++;
+                continue;
+            }
+
+            // Only flags, a width and a precision are passed on to snprintf
+            size_t end = format.find_first_not_of("-+ #0", i + 1);
+            end = end == std::string::npos ? end : format.find_first_not_of("0123456789", end);
+            if (end != std::string::npos && format[end] == '.')
+                end = format.find_first_not_of("0123456789", end + 1);
+            if (end == std::string::npos || strchr("sbcdiuoxXfeEgG", format[end]) == nullptr)
+            {
+                std::string bad = format.substr(i, end == std::string::npos ? end : end - i + 1);
+                std::cerr << "printf: " << bad << ": invalid conversion specification" << std::endl;
+                status = 1;
+                break;
+            }
+            std::string spec = format.substr(i, end - i);
+            char conv = format[end];
+            std::string arg = next < args.size() ? args[next++] : "";
+            consumed = true;
+            i = end;
+
+            if (conv == 's' || conv == 'b' || conv == 'c')
+            {
+                if (conv == 'c')
+                    arg = arg.substr(0, 1);
+                snprintf(buff, sizeof(buff), (spec + "s").c_str(), arg.c_str());
+            }
+            else if (conv == 'f' || conv == 'e' || conv == 'E' || conv == 'g' || conv == 'G')
+            {
+                snprintf(buff, sizeof(buff), (spec + conv).c_str(), strtod(arg.c_str(), NULL));
+            }
+            else
+            {
+                char *endp;
+                long long n = strtoll(arg.c_str(), &endp, 0);
+                if (!arg.empty() && *endp)
+                {
+                    std::cerr << "printf: " << arg << ": invalid number" << std::endl;
+                    status = 1;
+                }
+                snprintf(buff, sizeof(buff), (spec + "ll" + conv).c_str(), n);
+            }
+            out += buff;
+        }
+        if (!consumed)
+            break;
+    } while (next < args.size());
 
+    std::cout << out;
     return status;
 }
 
-/**
- * Following function performs the  task  of 
- * handling  the  execution of each  of  the 
- * command block, which the largest unit  in
- * the parse tree. The function makes use of
- * the execute_block function  for  handling 
- * the execution of each block stored in it.
- */
-int executors::execute(Command *c)
+int builtin::pwd(std::vector<std::string> &)
 {
-    int exec_val;
-    for (const auto &blk : c->Blocks)
+    char *cwd = getcwd(nullptr, 0);
+    if (cwd == nullptr)
     {
-        exec_val = execute_block(blk);
+        perror("pwd");
+        return 1;
     }
-    return exec_val;
+    std::cout << cwd << std::endl;
+    free(cwd);
+    return 0;
 }
 
 /**
- * The following function helps in pre  processing
- * the string. This function is a utility function 
- * specifically for the purpose of  parsing . This 
- * function removes any white/space character from
- * the beginning and the end of  the  string  thus 
- * cleaning up the string  for  further processing
+ * Following function pauses the shell for the 
+ * sum of its arguments. ^C ends the pause with 
+ * status 130.
  */
-std::string parser::trim(const std::string &trimStr)
+int builtin::sleepCmd(std::vector<std::string> &args)
 {
-    std::string str(trimStr);
-
-    // trim spaces from the front
-    std::reverse(str.begin(), str.end());
-    while (isspace(str.back()))
-        str.pop_back();
+    double seconds = 0, n;
+    for (auto &arg : args)
+    {
+        if (!utility::parseDuration(arg, n))
+        {
+            std::cerr << "sleep: invalid time interval '" << arg << "'" << std::endl;
+            return 1;
+        }
+        seconds += n;
+    }
 
-    // trim spaces from the end
-    std::reverse(str.begin(), str.end());
-    while (isspace(str.back()))
-        str.pop_back();
-    return str;
+    // SIGCHLD of a background job also ends the wait early
+    double deadline = utility::now() + seconds;
+    std::vector<struct pollfd> none;
+    for (double left = seconds; left > 0; left = deadline - utility::now())
+        if (events::wait(none, left) == -1 && errno == EINTR)
+            return 130;
+    return 0;
 }
 
 /**
- * Following funcion is a utility  function
- * specifically for the purpose of  parsing 
- * The function is used to split the string 
- * as per the delimeter passed as  the  arg
- * regexPattern. This function makes use of 
- * the in-built regex library.
+ * The following function runs the program of 
+ * the given name from PATH  instead  of  the 
+ * builtin. Used by the builtins for the options 
+ * that they do not implement themselves.
  */
-std::vector<std::string> parser::splitString(const std::string &stringToSplit, const std::string &regexPattern)
+int builtin::external(const std::string &prog, std::vector<std::string> &args)
 {
-    std::vector<std::string> result;
-
-    const std::regex rgx(regexPattern);
+    Atom a;
+    a.Program = prog;
+    a.Args = args;
+    a.OutputMode = 0;
+    return executors::execSingleCmd(&a, false);
+}
 
-    // -1 refers to capture all the substrings generated after splitting
-    std::sregex_token_iterator iter(stringToSplit.begin(), stringToSplit.end(), rgx, -1);
+/**
+ * The following function returns a descriptor to 
+ * read text from: a pipe that already holds it 
+ * when it fits the pipe buffer, otherwise a memfd 
+ * (writing more than that into a pipe nobody 
+ * reads yet would block the shell).
+ */
+int utility::hereFd(const std::string &text)
+{
+    int fdes[2];
+    if (pipe(fdes) == 0)
+    {
+        if ((ssize_t)text.length() <= fcntl(fdes[1], F_GETPIPE_SZ) &&
+            write(fdes[1], text.data(), text.length()) == (ssize_t)text.length())
+        {
+            close(fdes[1]);
+            return fdes[0];
+        }
+        close(fdes[0]);
+        close(fdes[1]);
+    }
 
-    for (std::sregex_token_iterator end; iter != end; ++iter)
+    int fd = memfd_create("here-string", 0);
+    if (fd == -1)
+        return -1;
+    if (write(fd, text.data(), text.length()) != (ssize_t)text.length() || lseek(fd, 0, SEEK_SET) == -1)
     {
-        result.push_back(trim(iter->str()));
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    return result;
+/**
+ * The following function returns the bytes the 
+ * kernel copies for an argv / envp array: every 
+ * string with its NUL and every pointer, with 
+ * the terminating NULL.
+ */
+size_t utility::arrBytes(char **arr)
+{
+    size_t bytes = sizeof(char *);
+    for (; *arr != NULL; arr++)
+        bytes += strlen(*arr) + 1 + sizeof(char *);
+    return bytes;
 }
 
 /**
- * The following function is the  main function
- * responsible  for  parsing  the  atom command 
- * statement  that  is  sent  as a  std::string 
- * parameter  to the  function.  This  function 
- * makes use of regex expressions for capturing 
- * the different parts of the Atom object.
- * 
- * the regex experession captures the
- * following groups :-
- *  0  =>  Full string
- *  1  =>  Runtime vars
- *  2  =>  Program
- *  3  =>  Args
- *  4  =>  Redirects
- * 
- * With the help of the redirects the 
- * function  sets  the values for the 
- * Input Stream and the Output Stream
- * 
- * If redirect string length is 2,
- * then as per the regex used  the 
- * Output Mode will be  set  to  1 
- * which is the append mode.
+ * The following function handles the builtin 
+ * xargs. The words read from stdin (separated 
+ * by white space, or by NUL with -0) are added 
+ * to CMD [ARGS] and packed greedily into as few 
+ * invocations as fit sysconf(_SC_ARG_MAX) 
+ * together with the environment (less 2 KiB of 
+ * headroom), -n caps the words per invocation. 
+ * A word the kernel refuses on its own (over 
+ * MAX_ARG_STRLEN, 32 pages) fails xargs before 
+ * anything runs.
+ * Up to -P invocations run at a time (0 = one 
+ * per cpu), the statuses are combined as:
  * 
- * The  arguments   and  the  redirect 
- * strings  that   were  captured  are 
- * further passed  though  the  argRgx 
- * and the redirRgx for capturing  the 
- * values. Finally  using  the  values
- * that were extracted using the regex
- * expressions are  used  to  set  the 
- * valus of the fields of atom object.
+ *  0   ->  every invocation succeeded
+ *  123 ->  some invocation exited with 1-125
+ *  124 ->  some invocation exited with 255
+ *  125 ->  some invocation was killed
+ *  126 / 127 -> CMD could not be run / found
+ *  130 ->  ^C stopped the invocations
  */
-Atom *parser::getAtom(std::string &cmd)
+int builtin::xargs(std::vector<std::string> &args)
 {
-    Atom *atom = new Atom();
-    atom->OutputStream = "";
-    atom->InputStream = "";
-    atom->OutputMode = 0;
+    long jobs = 1, max_words = 0;
+    bool nul = false;
+    size_t i = 0;
+    for (; i < args.size() && args[i].length() > 1 && args[i][0] == '-'; i++)
+    {
+        if (args[i] == "-0")
+            nul = true;
+        else if (args[i] == "-P" && i + 1 < args.size())
+            jobs = atol(args[++i].c_str());
+        else if (args[i] == "-n" && i + 1 < args.size())
+            max_words = atol(args[++i].c_str());
+        else
+        {
+            std::cerr << "xargs: usage: xargs [-0] [-P JOBS] [-n MAX] [CMD [ARGS]]" << std::endl;
+            return 1;
+        }
+    }
+    if (jobs <= 0)
+        jobs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
 
-    std::smatch matches;
-    std::regex rgx("((?:[a-zA-Z0-9-_]+=(?:(?:\"[^\"]*\")|(?:\'[^\']*\')|(?:[^ \'\"]*)) )*)([a-zA-Z0-9-_./]+)( [^><]*)? *((?:<|>>|>).*)?");
+    std::string prog = i < args.size() ? args[i] : "echo";
+    std::vector<std::string> fixed(args.begin() + std::min(i + 1, args.size()), args.end());
 
-    if (regex_search(cmd, matches, rgx))
+    // The words to distribute
+    std::string input;
+    char buff[65536];
+    ssize_t n;
+    while ((n = events::readable(STDIN_FILENO)) == 0 && (n = read(STDIN_FILENO, buff, sizeof(buff))) > 0)
+        input.append(buff, n);
+    // A ^C while waiting for input
+    if (n == -1 && errno == EINTR)
+        return 130;
+    std::vector<std::string> words;
+    std::string word;
+    for (char c : input)
     {
-        atom->Program = trim(matches[2].str());
-        atom->InputStream = "";
-        atom->OutputStream = "";
-
-        std::string vars = trim(matches[1].str());
-        std::regex varRgx("(([a-zA-Z0-9-_]+)=((?:\"[^\"]*\")|(?:\'[^\']*\')|(?:[^ \'\"]*)))");
-        std::smatch varMatch;
-        while (std::regex_search(vars, varMatch, varRgx))
+        if (nul ? c == '\0' : isspace((unsigned char)c))
         {
-            atom->RuntimeVars[varMatch[2].str()] = varMatch[3].str();
-            vars = varMatch.suffix().str();
+            if (!word.empty() || nul)
+                words.push_back(word);
+            word.clear();
         }
+        else
+            word += c;
+    }
+    if (!word.empty())
+        words.push_back(word);
+    if (words.empty())
+        return 0;
 
-        std::string args = matches[3].str();
-        std::regex argRgx("((?:\"[^\"]*\")|(?:\'[^\']*\')|(?:[^ \'\"]+))");
+    // Budget left for the words once the environment and CMD [ARGS] are in
+    char **Envs = utility::constructEnvArr({});
+    char **Fixed = utility::strToChrArr(prog, fixed);
+    long arg_max = sysconf(_SC_ARG_MAX);
+    long budget = arg_max - 2048 - (long)utility::arrBytes(Envs) - (long)utility::arrBytes(Fixed);
+    // MAX_ARG_STRLEN, the longest single string execve takes with its NUL
+    size_t max_strlen = 32 * sysconf(_SC_PAGESIZE);
+    free(Fixed);
 
-        std::smatch argMatches;
-        while (std::regex_search(args, argMatches, argRgx))
+    std::vector<std::pair<size_t, size_t>> batches;
+    long used = 0;
+    for (size_t w = 0; w < words.size(); w++)
+    {
+        long cost = words[w].length() + 1 + sizeof(char *);
+        if (cost > budget || words[w].length() + 1 > max_strlen)
+        {
+            std::cerr << "xargs: argument too long for " << prog << std::endl;
+            utility::freeEnvArr(Envs);
+            return 1;
+        }
+        if (batches.empty() || used + cost > budget || (max_words > 0 && (long)(w - batches.back().first) >= max_words))
+        {
+            batches.push_back({w, w});
+            used = 0;
+        }
+        batches.back().second = w + 1;
+        used += cost;
+    }
+
+    int status = 0;
+    bool stopped = false;
+    std::vector<std::pair<pid_t, int>> running;
+    std::vector<pid_t> outer = events::foreground;
+    auto combine = [&](int wstatus) {
+        int code = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+        int mapped = code == 0 ? 0 : code == -1 ? 125 : code == 255 ? 124 : code >= 126 ? code : 123;
+        status = std::max(status, mapped);
+    };
+    // Wait for at least one invocation (the oldest without pidfds), or for all of them
+    auto reap = [&](bool all) {
+        while (!running.empty())
         {
-            std::string s = argMatches[0].str();
-            if (s.length() > 0 && (s[0] == '"' || s[0] == '\''))
+            std::vector<struct pollfd> fds;
+            for (auto &child : running)
+                fds.push_back({child.second, POLLIN, 0});
+            bool pollable = std::all_of(fds.begin(), fds.end(), [](const struct pollfd &fd) { return fd.fd >= 0; });
+            if (pollable && events::wait(fds, -1) == -1)
             {
-                s.erase(s.begin());
-                s.erase(s.end() - 1);
+                // ^C went on to the running invocations, no new ones are started
+                if (errno == EINTR)
+                {
+                    stopped = true;
+                    continue;
+                }
+                pollable = false;
+            }
+            for (size_t k = running.size(); k-- > 0;)
+            {
+                if (pollable ? !(fds[k].revents & POLLIN) : !all && k != 0)
+                    continue;
+                int wstatus;
+                waitpid(running[k].first, &wstatus, 0);
+                combine(wstatus);
+                if (running[k].second >= 0)
+                    close(running[k].second);
+                events::foreground.erase(std::remove(events::foreground.begin(), events::foreground.end(), running[k].first), events::foreground.end());
+                running.erase(running.begin() + k);
             }
-            atom->Args.push_back(s);
-            args = argMatches.suffix().str();
+            if (!all)
+                return;
         }
+    };
 
-        std::string redirs = trim(matches[4].str());
-        std::regex redirRgx("((?:<|>>|>) *[^ ><]*)");
+    std::cout.flush();
+    for (auto &batch : batches)
+    {
+        std::vector<std::string> argv = fixed;
+        argv.insert(argv.end(), words.begin() + batch.first, words.begin() + batch.second);
+        char **Args = utility::strToChrArr(prog, argv);
 
-        std::smatch redirMatches;
-        while (std::regex_search(redirs, redirMatches, redirRgx))
+        pid_t pid = fork();
+        if (pid == 0)
         {
-            std::string redirStr = redirMatches[0].str();
-            if (redirStr[0] == '<')
+            events::unblock();
+            execvpe(Args[0], Args, Envs);
+            int err = errno;
+            perror(Args[0]);
+            _exit(err == ENOENT ? 127 : 126);
+        }
+        free(Args);
+        if (pid == -1)
+        {
+            perror("fork");
+            status = std::max(status, 125);
+            break;
+        }
+
+        running.push_back({pid, (int)syscall(SYS_pidfd_open, pid, 0)});
+        events::foreground.push_back(pid);
+        if ((long)running.size() >= jobs)
+            reap(false);
+        if (stopped)
+            break;
+    }
+    reap(true);
+    events::foreground = outer;
+
+    utility::freeEnvArr(Envs);
+    return stopped ? 130 : status;
+}
+
+/**
+ * The following function handles the builtin 
+ * cat. The files (or stdin for none / "-") are 
+ * moved to stdout with utility::copyFd,  so a 
+ * pipe is fed by splice and a file copied with 
+ * copy_file_range without passing through the 
+ * shell. Any option is left to the real cat.
+ */
+int builtin::cat(std::vector<std::string> &args)
+{
+    for (auto &arg : args)
+        if (arg.length() > 1 && arg[0] == '-')
+            return external("cat", args);
+
+    std::cout << std::flush;
+    std::vector<std::string> files(args);
+    if (files.empty())
+        files.push_back("-");
+
+    int status = 0;
+    for (auto &file : files)
+    {
+        int fd = file == "-" ? STDIN_FILENO : open(file.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            perror(("cat: " + file).c_str());
+            status = 1;
+            continue;
+        }
+        if (utility::copyFd(fd, STDOUT_FILENO) == -1 && errno != EPIPE)
+        {
+            // A ^C while waiting for input
+            status = errno == EINTR ? 130 : 1;
+            if (status == 1)
+                perror(("cat: " + file).c_str());
+        }
+        if (fd != STDIN_FILENO)
+            close(fd);
+        if (status == 130)
+            break;
+    }
+    return status;
+}
+
+/**
+ * The following function handles the builtin 
+ * tee, stdin is copied to stdout and to every 
+ * FILE (-a appends).
+ * 
+ * For the usual `cmd | tee log | next` the data 
+ * never enters user space: tee(2) duplicates the 
+ * pages of the input pipe into the output pipe 
+ * and splice(2) then moves the same bytes into 
+ * the log file. Other combinations of fds (or 
+ * more than one file) use a buffered copy.
+ */
+int builtin::tee(std::vector<std::string> &args)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    std::vector<int> fds;
+    int status = 0;
+
+    for (auto &arg : args)
+    {
+        if (arg == "-a")
+        {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            continue;
+        }
+        if (arg.length() > 1 && arg[0] == '-')
+        {
+            for (auto &fd : fds)
+                close(fd);
+            return external("tee", args);
+        }
+        int fd = open(arg.c_str(), flags, 0644);
+        if (fd == -1)
+        {
+            perror(("tee: " + arg).c_str());
+            status = 1;
+            continue;
+        }
+        fds.push_back(fd);
+    }
+
+    std::cout << std::flush;
+    if (fds.empty())
+    {
+        if (utility::copyFd(STDIN_FILENO, STDOUT_FILENO) == -1 && errno != EPIPE)
+            status = errno == EINTR ? 130 : 1;
+        return status;
+    }
+
+    struct stat in_st, out_st;
+    fstat(STDIN_FILENO, &in_st);
+    fstat(STDOUT_FILENO, &out_st);
+    ssize_t n = -1;
+    // A ^C while waiting for input
+    bool stopped = false;
+
+    if (fds.size() == 1 && S_ISFIFO(in_st.st_mode) && S_ISFIFO(out_st.st_mode))
+    {
+        while (!(stopped = events::readable(STDIN_FILENO) == -1) && (n = ::tee(STDIN_FILENO, STDOUT_FILENO, 1 << 20, 0)) > 0)
+        {
+            // Consume exactly the duplicated bytes into the file
+            for (ssize_t left = n; left > 0;)
             {
-                redirStr.erase(redirStr.begin());
-                redirStr = trim(redirStr);
-                if (redirStr.length() > 0)
-                    atom->InputStream = redirStr;
+                ssize_t moved = splice(STDIN_FILENO, NULL, fds[0], NULL, left, SPLICE_F_MOVE);
+                if (moved <= 0)
+                {
+                    // These bytes already reached stdout, only the
+                    // file is left to write before falling back
+                    std::vector<char> buff(left);
+                    for (ssize_t r; left > 0 && (r = read(STDIN_FILENO, buff.data(), left)) > 0; left -= r)
+                        if (write(fds[0], buff.data(), r) != r)
+                            status = 1;
+                    n = -1;
+                    break;
+                }
+                left -= moved;
             }
-            else
+            if (n == -1)
+                break;
+        }
+    }
+
+    if (n == -1 && !stopped)
+    {
+        // Buffered fallback, also taken when the kernel rejects the fds
+        std::vector<char> buff(1 << 17);
+        while (!(stopped = events::readable(STDIN_FILENO) == -1) && (n = read(STDIN_FILENO, buff.data(), buff.size())) > 0)
+        {
+            fds.push_back(STDOUT_FILENO);
+            for (auto &fd : fds)
             {
-                if (redirStr.length() >= 2)
+                for (ssize_t done = 0; done < n;)
                 {
-                    if (redirStr[1] == '>')
+                    ssize_t w = write(fd, buff.data() + done, n - done);
+                    if (w == -1)
                     {
-                        redirStr.erase(redirStr.begin());
-                        atom->OutputMode = 0;
-                    }
-                    else
-                    {
-                        atom->OutputMode = 1;
+                        status = 1;
+                        break;
                     }
-
-                    redirStr.erase(redirStr.begin());
-                    redirStr = trim(redirStr);
-                    if (redirStr.length() > 0)
-                        atom->OutputStream = redirStr;
+                    done += w;
                 }
             }
-            redirs = redirMatches.suffix().str();
-            // Multiple matches will overwrite
+            fds.pop_back();
         }
     }
-    return atom;
+
+    for (auto &fd : fds)
+        close(fd);
+    if (stopped)
+        return 130;
+    return n == 0 ? status : 1;
 }
 
 /**
- * The following function is the main
- * function that handles the  parsing  
- * of the  block  statements that are 
- * passed as a std::string parameter.
- * 
- * getBlock make use of  the  getAtom 
- * utility  function  in  the  parser 
- * namespace that for further parsing
- * and creating of  the Atom  objects
- * 
- * The  IsBackgroundProcess  is a boolean
- * field which keeps track of whether the 
- * code is to be run in the background or 
- * not. 
- * 
- * The split string command is used
- * to split the  block  string into 
- * atom string. The  atom  string do 
- * not contain any  "|" hence we use
- * "|"  as  the  delimiter  for  the 
- * splitting of string. "|" -> PIPE
+ * The following function switches the pipestat 
+ * report on or off. Without an argument it tells 
+ * whether the report is on.
  */
-Block *parser::getBlock(std::string &cmd)
+int builtin::pipestat(std::vector<std::string> &args)
 {
-    Block *blk = new Block();
-    if (*(cmd.end() - 1) == '&')
+    if (args.empty())
     {
-        // Background process
-        blk->IsBackgroundProcess = true;
-        cmd.erase(cmd.end() - 1);
+        std::cout << "pipestat " << (pipestat_enabled ? "on" : "off") << std::endl;
+        return 0;
     }
-    else
+    if (args[0] != "on" && args[0] != "off")
     {
-        blk->IsBackgroundProcess = false;
+        std::cerr << "pipestat: usage: pipestat [on|off]" << std::endl;
+        return 2;
     }
+    pipestat_enabled = args[0] == "on";
+    return 0;
+}
 
-    cmd = trim(cmd);
+/**
+ * The following function switches the passes 
+ * of the optimizer, all of them or one by name, 
+ * and the trace of the rewrites. Without any 
+ * argument the current settings are listed.
+ */
+int builtin::optimize(std::vector<std::string> &args)
+{
+    if (args.empty())
+    {
+        for (auto &pass : optimizer::passes)
+            std::cout << "optimize " << pass.Name << " " << (optimizer::enabled & pass.Bit ? "on" : "off") << std::endl;
+        std::cout << "optimize trace " << (optimizer::trace ? "on" : "off") << std::endl;
+        return 0;
+    }
 
-    auto singles = splitString(cmd, "\\|");
-    for (auto s : singles)
+    std::string name = args.size() == 2 ? args[0] : "";
+    std::string value = args.back();
+    if (args.size() > 2 || (value != "on" && value != "off"))
     {
-        blk->Atoms.push_back(getAtom(s));
+        std::cerr << "optimize: usage: optimize [PASS|trace] [on|off]" << std::endl;
+        return 2;
     }
 
-    return blk;
+    if (name == "trace")
+    {
+        optimizer::trace = value == "on";
+        return 0;
+    }
+    unsigned bits = 0;
+    for (auto &pass : optimizer::passes)
+        if (name.empty() || name == pass.Name)
+            bits |= pass.Bit;
+    if (bits == 0)
+    {
+        std::cerr << "optimize: " << name << ": no such pass" << std::endl;
+        return 1;
+    }
+    optimizer::enabled = value == "on" ? optimizer::enabled | bits : optimizer::enabled & ~bits;
+    return 0;
 }
 
 /**
- * The following function is the main
- * function that handles the  parsing  
- * of the command statements that are 
- * passed as a std::string parameter.
+ * The following function handles the builtin 
+ * jobs, over the jobs whose output is captured:
  * 
- * Parse  make use  of  the  getBlock 
- * utility  function  in  the  parser 
- * namespace that for further parsing
- * and creating of the block  objects
+ *  >>> jobs             list them with their state
+ *  >>> jobs -c on|off   capture the next background jobs
+ *  >>> jobs -o %N       print the output of job N
+ *  >>> jobs -f %N       print it and follow it until it ends
  * 
- * The split string command is used
- * to split the command string into 
- * block string. The block string do 
- * not contain any "&&" hence we use
- * "&&"  as  the  delimiter  for the 
- * splitting of string.
+ * A finished job is forgotten once its output 
+ * has been printed.
  */
-Command *parser::Parse(const std::string &cmd)
+int builtin::jobs(std::vector<std::string> &args)
 {
-    auto singles = splitString(cmd, "&&");
-    Command *cmds = new Command();
-    for (auto &s : singles)
+    utility::reapJobs();
+    if (args.empty())
     {
-        cmds->Blocks.push_back(getBlock(s));
+        std::lock_guard<std::mutex> guard(capture::lock);
+        for (auto &entry : capture::jobs)
+        {
+            const capture::Job &job = entry.second;
+            std::cout << "[" << entry.first << "] " << (capture::finished(job) ? "Done   " : "Running") << " "
+                      << std::setw(10) << job.Total << " bytes  " << job.Command << std::endl;
+        }
+        return 0;
     }
-    return cmds;
+
+    if (args[0] == "-c")
+    {
+        if (args.size() == 1)
+            std::cout << "jobs -c " << (capture::enabled ? "on" : "off") << std::endl;
+        else if (args[1] == "on" || args[1] == "off")
+            capture::enabled = args[1] == "on";
+        else
+        {
+            std::cerr << "jobs: usage: jobs -c [on|off]" << std::endl;
+            return 2;
+        }
+        return 0;
+    }
+
+    if ((args[0] == "-o" || args[0] == "-f") && args.size() == 2)
+    {
+        std::string spec = args[1][0] == '%' ? args[1].substr(1) : args[1];
+        int id = atoi(spec.c_str());
+        bool known;
+        {
+            std::lock_guard<std::mutex> guard(capture::lock);
+            known = capture::jobs.count(id) != 0;
+        }
+        if (!known)
+        {
+            std::cerr << "jobs: " << args[1] << ": no such job" << std::endl;
+            return 1;
+        }
+        return capture::show(id, args[0] == "-f");
+    }
+
+    std::cerr << "jobs: usage: jobs [-c on|off] [-o %N] [-f %N]" << std::endl;
+    return 2;
+}
+
+/**
+ * The following function handles the builtin 
+ * exec. CMD replaces the process the builtin 
+ * runs in, which is the shell itself unless 
+ * exec is a stage of a pipeline. Only failing 
+ * to start CMD returns (126 / 127). Without a 
+ * command there is nothing to do here, the 
+ * redirections are kept by execute_block.
+ */
+int builtin::exec(std::vector<std::string> &args)
+{
+    if (args.empty())
+        return 0;
+    Atom a;
+    a.Program = args[0];
+    a.Args.assign(args.begin() + 1, args.end());
+    a.OutputMode = 0;
+    return executors::replace(&a);
+}
+
+/**
+ * The following function  turns  builtins 
+ * on and off. A disabled builtin is looked 
+ * up in PATH like any other program, which 
+ * allows a real binary to take over from the 
+ * in-process version.
+ * 
+ * enable                   ->  list the builtins
+ * enable -n NAME           ->  disable NAME
+ * enable NAME              ->  enable NAME again
+ * enable -f FILE.so NAME   ->  load NAME from FILE.so
+ * enable -d NAME           ->  remove the loaded NAME
+ */
+int builtin::enable(std::vector<std::string> &args)
+{
+    if (args.empty())
+    {
+        for (auto &cmd : builtin_commands)
+            std::cout << (disabled.count(normalize(cmd.Name)) ? "enable -n " : "enable ") << cmd.Name << std::endl;
+        for (auto &cmd : loaded)
+            std::cout << (disabled.count(cmd.first) ? "enable -n " : "enable ") << cmd.first << " (loaded)" << std::endl;
+        return 0;
+    }
+
+    int status = 0;
+    if (args[0] == "-f")
+    {
+        if (args.size() < 3)
+        {
+            std::cerr << "enable: usage: enable -f FILE NAME [NAME...]" << std::endl;
+            return 2;
+        }
+        for (size_t i = 2; i < args.size(); i++)
+            status |= load(args[1], args[i]);
+        return status;
+    }
+
+    if (args[0] == "-d")
+    {
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            auto it = loaded.find(normalize(args[i]));
+            if (it == loaded.end())
+            {
+                std::cerr << "enable: " << args[i] << ": not a loaded builtin" << std::endl;
+                status = 1;
+                continue;
+            }
+            dlclose(it->second.second);
+            loaded.erase(it);
+        }
+        return status;
+    }
+
+    bool disable = args[0] == "-n";
+    for (size_t i = disable ? 1 : 0; i < args.size(); i++)
+    {
+        if (lookup(args[i]) == -1 && loaded.find(normalize(args[i])) == loaded.end())
+        {
+            std::cerr << "enable: " << args[i] << ": not a shell builtin" << std::endl;
+            status = 1;
+        }
+        else if (disable)
+            disabled.insert(normalize(args[i]));
+        else
+            disabled.erase(normalize(args[i]));
+    }
+    return status;
+}
+
+/**
+ * The following function handles 
+ * the execution of a single line
+ * function that is stored a Atom 
+ * object.
+ * 
+ * 1. Convert  the  args  to  char**
+ * 2. Convert the env Vars to char**
+ * 3. Fork to create a child process
+ * 
+ *    On succesful creation of the child
+ *    process we get either 0 or the pid 
+ *    of  the  child  process so created. 
+ *    Wait teh child process  to  finish 
+ *    execution.
+ */
+int executors::execSingleCmd(Atom *a, bool bg)
+{
+    if (a->Program.empty())
+        return 0;
+
+    char **Args = utility::strToChrArr(a->Program, a->Args);
+    char **Envs = utility::constructEnvArr(a->RuntimeVars);
+
+    int pid = fork(), status = 0;
+    if (pid == 0)
+    {
+        if (bg)
+            setpgid(0, 0);
+        events::unblock();
+        execvpe(Args[0], Args, Envs);
+        perror(Args[0]);
+        // Never fall back into the shell loop from the child
+        _exit(127);
+    }
+    else if (pid == -1)
+    {
+        perror("fork");
+        status = 1;
+    }
+    else
+    {
+        waitpid(pid, &status, 0);
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+
+    free(Args);
+    utility::freeEnvArr(Envs);
+    return status;
+}
+
+/**
+ * Following function replaces the shell by the 
+ * program of the atom, with the stdin / stdout 
+ * that are currently set up. It only returns 
+ * when the program could not be started, with 
+ * 127 when it was not found and 126 otherwise.
+ */
+int executors::replace(Atom *a)
+{
+    char **Args = utility::strToChrArr(a->Program, a->Args);
+    char **Envs = utility::constructEnvArr(a->RuntimeVars);
+
+    std::cout.flush();
+    std::cerr.flush();
+    events::unblock();
+    execvpe(Args[0], Args, Envs);
+
+    int err = errno;
+    perror(Args[0]);
+    sigprocmask(SIG_BLOCK, &events::mask, NULL);
+    free(Args);
+    utility::freeEnvArr(Envs);
+    return err == ENOENT ? 127 : 126;
+}
+
+/**
+ * Following function tells whether the shell 
+ * may be replaced, which is not the case while 
+ * one of its threads still serves a job (the 
+ * deadline of a timed job or the reader of a 
+ * captured one).
+ */
+bool executors::mayReplace()
+{
+    {
+        std::lock_guard<std::mutex> guard(watchdog::lock);
+        if (!watchdog::watches.empty())
+            return false;
+    }
+    std::lock_guard<std::mutex> guard(capture::lock);
+    for (auto &entry : capture::jobs)
+        if (entry.second.Pipe != -1)
+            return false;
+    return true;
+}
+
+/**
+ * Following function is the main handler 
+ * of any execution  related to statement 
+ * stored  as  an  atom, that is the most 
+ * basic command  in the shell.
+ * 
+ * For this we  find  whether  the  program 
+ * is part of any of the predefined builtin
+ * functions. If so then send the program to 
+ * the builtin function handler for further 
+ * execution. Shell functions take precedence
+ * over the builtins and are run in-process.
+ * 
+ * Otherwise make use of the single command 
+ * handler utility provided in the executor
+ * namespace defined. 
+ * 
+ * Boolean type bg menstions whether the 
+ * program  should   be  sent  into  the 
+ * background for running
+ */
+int executors::execute_atom(Atom *a, bool bg)
+{
+    int exec_val;
+    const std::string &cmd = a->Program;
+
+    auto fn = functions.find(cmd);
+    if (fn != functions.end())
+    {
+        exec_val = call(fn->second, a->Args);
+        std::cout << std::flush;
+        return exec_val;
+    }
+
+    auto bin = builtin::find(cmd);
+    if (bin != nullptr)
+    {
+        exec_val = bin(a->Args);
+        std::cout << std::flush;
+        return exec_val;
+    }
+    else
+    {
+        exec_val = execSingleCmd(a, bg);
+    }
+    return exec_val;
+}
+
+/**
+ * Following function opens the  redirection 
+ * target of an atom, < for the input stream 
+ * and >/>> for the  output  stream. Returns 
+ * the new file descriptor or -1 on error.
+ */
+int executors::openStream(Atom *a, bool output)
+{
+    if (!output)
+        return open(a->InputStream.c_str(), O_RDONLY);
+
+    int flags = O_WRONLY | O_CREAT;
+    if (a->OutputMode == 1)
+        flags |= O_TRUNC;
+    else
+        flags |= O_APPEND;
+    return open(a->OutputStream.c_str(), flags, 0644);
+}
+
+/**
+ * The following function starts an atom  in  a 
+ * forked child with the stdin / stdout that are 
+ * currently set up by execute_block.  Functions 
+ * and builtins run inside of the child, other 
+ * programs replace it through execvpe.
+ * 
+ * Background stages and the stages of a block 
+ * with limits are moved into the process group 
+ * pgid (0 creates a new group led by the child), 
+ * a timed foreground job also takes over the 
+ * terminal. The cpu and memory budgets are set 
+ * with setrlimit before the program starts. 
+ * unused_fd is closed in the child. The pid of 
+ * the child is returned.
+ */
+pid_t executors::spawn_atom(Atom *a, bool bg, pid_t pgid, int unused_fd, const Limits *limits)
+{
+    bool own_group = bg || limits != nullptr;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Read end of the pipe this stage writes to
+        if (unused_fd != -1)
+            close(unused_fd);
+        if (own_group)
+            setpgid(0, pgid);
+        if (own_group && !bg && tty_fd != -1)
+        {
+            signal(SIGTTOU, SIG_IGN);
+            tcsetpgrp(tty_fd, getpgrp());
+            signal(SIGTTOU, SIG_DFL);
+        }
+        events::unblock();
+
+        if (limits && limits->CpuSeconds > 0)
+        {
+            struct rlimit rl = {(rlim_t)limits->CpuSeconds, (rlim_t)limits->CpuSeconds + 1};
+            setrlimit(RLIMIT_CPU, &rl);
+        }
+        if (limits && limits->Memory > 0)
+        {
+            struct rlimit rl = {(rlim_t)limits->Memory, (rlim_t)limits->Memory};
+            setrlimit(RLIMIT_AS, &rl);
+        }
+
+        const std::string &cmd = a->Program;
+        auto fn = functions.find(cmd);
+        auto bin = builtin::find(cmd);
+        if (fn != functions.end() || bin != nullptr)
+        {
+            int exec_val = fn != functions.end() ? call(fn->second, a->Args) : bin(a->Args);
+            std::cout << std::flush;
+            _exit(exec_val);
+        }
+        if (cmd.empty())
+            _exit(0);
+
+        char **Args = utility::strToChrArr(a->Program, a->Args);
+        char **Envs = utility::constructEnvArr(a->RuntimeVars);
+        execvpe(Args[0], Args, Envs);
+        perror(Args[0]);
+        _exit(127);
+    }
+    else if (pid == -1)
+    {
+        perror("fork");
+    }
+    else if (own_group)
+    {
+        setpgid(pid, pgid == 0 ? pid : pgid);
+    }
+    return pid;
+}
+
+/**
+ * Following function waits for all the given 
+ * children and returns the exit status of the 
+ * last one.
+ * 
+ * Each child is watched through a pidfd, poll 
+ * tells which one exited first, so the moment 
+ * every stage finished is known without ever 
+ * blocking on a single pid. When stats is given 
+ * the counters of a child are sampled before it 
+ * is reaped by wait4 (cpu time and max rss come 
+ * from its rusage).
+ * 
+ * With a timeout in limits a timerfd joins the 
+ * poll, when it expires the process group pgid 
+ * is sent SIGTERM and after the grace period 
+ * SIGKILL. The status of a timed out job is 
+ * 124. Nothing wakes up the shell in between.
+ * 
+ * Kernels without pidfd_open are handled by 
+ * reaping the children in order.
+ */
+int executors::waitStages(const std::vector<pid_t> &pids, std::vector<StageStat> *stats, const Limits *limits, pid_t pgid)
+{
+    int status = 0;
+    std::vector<struct pollfd> fds(pids.size());
+    size_t watched = 0;
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        fds[i].fd = syscall(SYS_pidfd_open, pids[i], 0);
+        fds[i].events = POLLIN;
+        if (fds[i].fd >= 0)
+            watched++;
+    }
+
+    int timer = -1;
+    bool escalated = false;
+    if (limits && limits->Timeout > 0 && pgid > 0 && watched > 0)
+    {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        utility::armTimer(timer, limits->Timeout);
+        fds.push_back({timer, POLLIN, 0});
+    }
+
+    auto reap = [&](size_t i) {
+        if (stats)
+        {
+            StageStat &st = (*stats)[i];
+            st.Wall = utility::now() - st.Start;
+            siginfo_t info;
+            waitid(P_PID, pids[i], &info, WEXITED | WNOWAIT);
+            utility::sampleStage(pids[i], st);
+        }
+
+        int wstatus;
+        struct rusage ru;
+        if (wait4(pids[i], &wstatus, 0, &ru) <= 0)
+            return;
+        if (i == pids.size() - 1)
+            status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+        if (stats)
+        {
+            (*stats)[i].Cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+            (*stats)[i].MaxRss = ru.ru_maxrss;
+        }
+    };
+
+    // ^C is passed on to the stages while they run
+    std::vector<pid_t> outer = events::foreground;
+    events::foreground.insert(events::foreground.end(), pids.begin(), pids.end());
+    while (watched > 0)
+    {
+        if (events::wait(fds, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (timer != -1 && (fds.back().revents & POLLIN))
+            utility::escalate(pgid, timer, escalated, limits->KillAfter);
+
+        for (size_t i = 0; i < pids.size(); i++)
+        {
+            if (fds[i].fd < 0 || !(fds[i].revents & POLLIN))
+                continue;
+            reap(i);
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            watched--;
+        }
+    }
+
+    events::foreground = outer;
+    if (timer != -1)
+    {
+        close(timer);
+        fds.pop_back();
+    }
+    if (escalated)
+    {
+        std::cerr << "dmsh: timed out after " << limits->Timeout << "s" << std::endl;
+        status = 124;
+    }
+
+    // Children that could not be watched are reaped in order
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        if (fds[i].fd >= 0)
+        {
+            close(fds[i].fd);
+            reap(i);
+        }
+        else if (!(fds[i].revents & POLLIN))
+            reap(i);
+    }
+    return status;
+}
+
+/**
+ * The following function parses the timeout 
+ * prefix of the atom into limits and  turns 
+ * the atom into the command it prefixes:
+ * 
+ *  >>> timeout [-k KILL_AFTER] [-c CPU_SECONDS] [-m MEMORY] DURATION CMD [ARGS]
+ * 
+ * A DURATION of 0 sets no deadline, which is 
+ * useful together with -c / -m. Returns false 
+ * (after printing why) for a malformed prefix.
+ */
+bool executors::parseLimits(Atom *a, Limits &limits)
+{
+    limits = {0, 5, 0, 0};
+    std::vector<std::string> &args = a->Args;
+    size_t i = 0;
+    for (; i + 1 < args.size() && args[i].length() == 2 && args[i][0] == '-'; i += 2)
+    {
+        double seconds;
+        long long bytes;
+        bool ok = true;
+        if (args[i] == "-k")
+            ok = utility::parseDuration(args[i + 1], limits.KillAfter);
+        else if (args[i] == "-c")
+        {
+            ok = utility::parseDuration(args[i + 1], seconds) && seconds >= 1;
+            limits.CpuSeconds = (long)seconds;
+        }
+        else if (args[i] == "-m")
+        {
+            ok = utility::parseSize(args[i + 1], bytes) && bytes > 0;
+            limits.Memory = bytes;
+        }
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            std::cerr << "timeout: invalid option " << args[i] << " " << args[i + 1] << std::endl;
+            return false;
+        }
+    }
+
+    if (i + 1 >= args.size() || !utility::parseDuration(args[i], limits.Timeout))
+    {
+        std::cerr << "timeout: usage: timeout [-k KILL] [-c CPU] [-m MEMORY] DURATION COMMAND [ARGS]" << std::endl;
+        return false;
+    }
+    a->Program = args[i + 1];
+    args.erase(args.begin(), args.begin() + i + 2);
+    a->Literal.erase(a->Literal.begin(), a->Literal.begin() + std::min(a->Literal.size(), i + 2));
+    return true;
+}
+
+/**
+ * Following function is the main  function 
+ * for handling the execution of the  block 
+ * level statements. Block level statements
+ * may contain pipes, so pipes are  handled
+ * as a part of this code.
+ * 
+ * All the atoms of the block are started in
+ * a loop and run  concurrently.  Every  atom 
+ * except the last one is forked with  its 
+ * stdout connected to the pipe read by the 
+ * next atom. An atom's own < and > override 
+ * the pipe on that side.
+ * 
+ * A function or builtin that is the last atom 
+ * of a foreground block goes through execute_atom, 
+ * so builtins like cd or echo run inside of the 
+ * shell  itself. A builtin that is an earlier 
+ * pipeline stage (or in a background block) is 
+ * run by a forked child so that it cannot block 
+ * the shell on a full pipe.
+ * 
+ * The status is the one of the last  atom. 
+ * Finally restore the stdin file descriptor 
+ * and the stdout file descriptor, with pipestat 
+ * on the statistics of every atom are reported.
+ * 
+ * With limits (from the timeout prefix, or the 
+ * default deadline $DMSH_TIMEOUT) the block gets 
+ * its own process group. Under the prefix even 
+ * the builtins are forked so the deadline can 
+ * stop them, the default deadline forks every 
+ * stage of a pipeline but leaves a lone builtin 
+ * in the shell.
+ * 
+ * With tail (nothing runs after the block) a 
+ * lone external command is not forked, it is 
+ * exec'd in place of the shell. `exec` without 
+ * a command leaves its < / > in place.
+ * 
+ * The optimizer may drop stages of the expanded 
+ * block first (see optimizer). A background block 
+ * writes to its capture pipe when the output of 
+ * jobs is captured (see capture).
+ */
+int executors::execute_block(Block *b, const Limits *limits, bool tail)
+{
+    // Variables are substituted on a copy, the
+    // parsed block is reused by loops
+    Block expanded;
+    if (utility::needsExpansion(b))
+    {
+        expanded.IsBackgroundProcess = b->IsBackgroundProcess;
+        for (auto &atom : b->Atoms)
+            expanded.Atoms.push_back(utility::expandAtom(atom));
+        b = &expanded;
+    }
+
+    if (b->Atoms[0]->Program == "cached")
+        return execute_cached(b, limits);
+
+    // The timeout prefix applies to the whole block
+    Limits own;
+    Block stripped;
+    if (b->Atoms[0]->Program == "timeout")
+    {
+        stripped.IsBackgroundProcess = b->IsBackgroundProcess;
+        for (auto &atom : b->Atoms)
+            stripped.Atoms.push_back(new Atom(*atom));
+        if (!parseLimits(stripped.Atoms[0], own))
+            return 125;
+        return execute_block(&stripped, &own);
+    }
+
+    // Otherwise the shell wide deadline, for the forked stages
+    bool forced = limits != nullptr;
+    std::string deadline = limits ? "" : utility::lookupVar("DMSH_TIMEOUT");
+    if (!deadline.empty())
+    {
+        own = {0, 5, 0, 0};
+        if (utility::parseDuration(deadline, own.Timeout) && own.Timeout > 0)
+            limits = &own;
+    }
+
+    // Fewer stages where a rewrite keeps the result the same
+    Block optimized;
+    bool dropped_cat = false;
+    if (optimizer::enabled && !limits)
+        b = optimizer::rewrite(b, optimized, dropped_cat);
+
+    // Under the default deadline the last stage of a pipeline is
+    // forked as well, the deadline is only armed for children. A
+    // lone builtin (cd, export, ...) still runs in the shell
+    if (limits && b->Atoms.size() > 1)
+        forced = true;
+
+    // Children started by execvpe must not inherit the copies
+    int stdin_copy = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    int stdout_copy = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    // The output of a captured background job goes to its ring
+    int capture_pipe[2] = {-1, -1}, stderr_copy = -1;
+    if (b->IsBackgroundProcess && capture::enabled && pipe2(capture_pipe, O_CLOEXEC) == 0)
+    {
+        stderr_copy = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(capture_pipe[1], STDERR_FILENO);
+    }
+
+    int status = 0;
+    bool aborted = false, keep_streams = false;
+    int fdin = dup(stdin_copy), fdout, next_in = -1;
+    pid_t pgid = 0;
+    std::vector<pid_t> pids;
+    std::vector<StageStat> stats;
+    // In-process stage, measured from the shell's own rusage
+    StageStat self = {"", 0, 0, 0, 0, 0, -1, -1, -1};
+
+    for (int i = 0; i < b->Atoms.size(); i++)
+    {
+        Atom *a = b->Atoms[i];
+        bool last = i == b->Atoms.size() - 1;
+        const char *failed = nullptr;
+
+        if (!a->InputStream.empty())
+        {
+            close(fdin);
+            fdin = openStream(a, false);
+            if (fdin == -1)
+                failed = a->InputStream.c_str();
+        }
+        else if (!a->HereString.empty())
+        {
+            close(fdin);
+            fdin = utility::hereFd(a->HereString);
+            if (fdin == -1)
+                failed = "here-string";
+        }
+
+        next_in = -1;
+        if (last)
+        {
+            fdout = dup(capture_pipe[1] != -1 ? capture_pipe[1] : stdout_copy);
+        }
+        else
+        {
+            int fdes[2];
+            if (pipe(fdes) == -1)
+            {
+                fdout = -1;
+                failed = "pipe";
+            }
+            else
+            {
+                fdout = fdes[1];
+                next_in = fdes[0];
+                fcntl(next_in, F_SETFD, FD_CLOEXEC);
+            }
+        }
+
+        if (!failed && !a->OutputStream.empty())
+        {
+            close(fdout);
+            fdout = openStream(a, true);
+            if (fdout == -1)
+                failed = a->OutputStream.c_str();
+        }
+
+        if (failed)
+        {
+            // Stop the block, the stdin / stdout are restored below
+            perror(failed);
+            for (int fd : {fdin, fdout, next_in})
+                if (fd != -1)
+                    close(fd);
+            status = 1;
+            aborted = true;
+            break;
+        }
+
+        dup2(fdin, STDIN_FILENO);
+        close(fdin);
+        dup2(fdout, STDOUT_FILENO);
+        close(fdout);
+
+        // A timed block runs every stage in a child that can be killed
+        bool in_process = !forced && (functions.count(a->Program) || builtin::find(a->Program) || a->Program.empty());
+        // The last command of a script becomes the shell itself, unless
+        // it lost a trailing cat whose status the shell has to return
+        bool elide = tail && last && b->Atoms.size() == 1 && !b->IsBackgroundProcess && !in_process &&
+                     limits == nullptr && !pipestat_enabled && !dropped_cat && mayReplace();
+        if (elide)
+        {
+            status = replace(a);
+        }
+        else if (last && !b->IsBackgroundProcess && in_process)
+        {
+            // exec without a command keeps its redirections for the shell
+            keep_streams = a->Program == "exec" && a->Args.empty() && b->Atoms.size() == 1 && !functions.count("exec");
+            struct rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            self.Name = a->Program + " (shell)";
+            self.Start = utility::now();
+
+            // ^C reaches the earlier stages while the shell runs the last
+            std::vector<pid_t> outer = events::foreground;
+            events::foreground.insert(events::foreground.end(), pids.begin(), pids.end());
+            status = execute_atom(a, false);
+            events::foreground = outer;
+
+            getrusage(RUSAGE_SELF, &after);
+            self.Wall = utility::now() - self.Start;
+            self.Cpu = after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_stime.tv_sec +
+                       (after.ru_utime.tv_usec - before.ru_utime.tv_usec + after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+            self.Blocked = std::max(0.0, self.Wall - self.Cpu);
+            self.Pid = getpid();
+        }
+        else
+        {
+            double start = utility::now();
+            pid_t pid = spawn_atom(a, b->IsBackgroundProcess, pgid, next_in, limits);
+            if (pid > 0)
+            {
+                pids.push_back(pid);
+                stats.push_back({a->Program, pid, start, 0, 0, 0, 0, -1, -1});
+                if (pgid == 0)
+                    pgid = pid;
+            }
+            else if (last)
+            {
+                status = 1;
+            }
+        }
+        fdin = next_in;
+    }
+
+    if (!keep_streams || aborted)
+    {
+        dup2(stdin_copy, STDIN_FILENO);
+        dup2(stdout_copy, STDOUT_FILENO);
+    }
+    close(stdin_copy);
+    close(stdout_copy);
+    if (capture_pipe[1] != -1)
+    {
+        dup2(stderr_copy, STDERR_FILENO);
+        close(stderr_copy);
+        close(capture_pipe[1]);
+    }
+
+    if (b->IsBackgroundProcess)
+    {
+        running_jobs.insert(running_jobs.end(), pids.begin(), pids.end());
+        events::watch(pids, optimizer::render(b));
+        if (limits && limits->Timeout > 0 && pgid > 0)
+            watchdog::add(pgid, pids, *limits);
+        if (capture_pipe[0] != -1 && !pids.empty())
+            capture::add(pids, optimizer::render(b), capture_pipe[0]);
+        else if (capture_pipe[0] != -1)
+            close(capture_pipe[0]);
+        // The same number is reported when the job is done
+        if (!pids.empty())
+            std::cerr << "[" << pids[0] << "] ";
+        std::cerr << "Command sent to background" << std::endl;
+        return 0;
+    }
+
+    // The earlier stages see EOF / SIGPIPE now that the shell
+    // holds no pipe ends, reap them
+    bool last_forked = self.Pid == 0 && status == 0;
+    int exec_val = waitStages(pids, pipestat_enabled ? &stats : nullptr, limits, pgid);
+    if (last_forked)
+        status = exec_val;
+    // A removed trailing cat fails only when its stdout went away
+    if (dropped_cat && !aborted)
+        status = status == 128 + SIGPIPE ? status : 0;
+
+    if (limits && tty_fd != -1)
+    {
+        // Take the terminal back from the timed job
+        signal(SIGTTOU, SIG_IGN);
+        tcsetpgrp(tty_fd, getpgrp());
+        signal(SIGTTOU, SIG_DFL);
+    }
+
+    // No report for the command that switched it on
+    bool toggle = b->Atoms.size() == 1 && b->Atoms[0]->Program == "pipestat";
+    if (pipestat_enabled && !toggle)
+    {
+        if (self.Pid != 0)
+            stats.push_back(self);
+        utility::printPipestat(stats);
+    }
+    return status;
+}
+
+/**
+ * The following function runs a block whose 
+ * first atom carries the `cached` prefix:
+ * 
+ *  >>> cached [-i FILE]... [-e VAR]... CMD [ARGS] [| ...]
+ * 
+ * The fingerprint of the block (programs, Args, 
+ * RuntimeVars, < files, the declared input files 
+ * -i and variables -e, the cwd and PATH) is 
+ * looked up in the cache store. On a hit the 
+ * stored stdout and exit status are replayed 
+ * without spawning anything. On a miss the block 
+ * runs with its final stdout captured into the 
+ * store and the capture is replayed afterwards.
+ * 
+ * Stdin that is not redirected with < is not 
+ * part of the fingerprint. Background blocks are 
+ * never cached.
+ */
+int executors::execute_cached(Block *b, const Limits *limits)
+{
+    // Work on a copy without the prefix
+    Block blk;
+    blk.IsBackgroundProcess = b->IsBackgroundProcess;
+    for (auto &atom : b->Atoms)
+        blk.Atoms.push_back(new Atom(*atom));
+
+    Atom *first = blk.Atoms[0];
+    std::vector<std::string> inputs, vars;
+    size_t i = 0;
+    for (; i < first->Args.size(); i++)
+    {
+        const std::string &arg = first->Args[i];
+        if (arg == "--stats" && first->Args.size() == 1)
+            return cache::stats();
+        if (arg == "--clear" && first->Args.size() == 1)
+            return cache::clear();
+        if ((arg == "-i" || arg == "-e") && i + 1 < first->Args.size())
+            (arg == "-i" ? inputs : vars).push_back(first->Args[++i]);
+        else
+            break;
+    }
+    if (i == first->Args.size())
+    {
+        std::cerr << "cached: usage: cached [-i FILE] [-e VAR] COMMAND [ARGS]" << std::endl;
+        return 2;
+    }
+    first->Program = first->Args[i];
+    first->Args.erase(first->Args.begin(), first->Args.begin() + i + 1);
+    first->Literal.erase(first->Literal.begin(), first->Literal.begin() + std::min(first->Literal.size(), i + 1));
+
+    if (blk.IsBackgroundProcess)
+        return execute_block(&blk, limits);
+
+    Atom *last = blk.Atoms.back();
+    std::string target = last->OutputStream;
+    bool mode = last->OutputMode;
+    std::string key = cache::key(&blk, inputs, vars);
+
+    std::string object;
+    int status = 0;
+    bool hit = cache::lookup(key, object, status);
+    cache::count(hit);
+
+    if (!hit)
+    {
+        std::string tmp = cache::storeDir() + "/objects/tmp." + std::to_string(getpid());
+        last->OutputStream = tmp;
+        last->OutputMode = 1;
+        status = execute_block(&blk, limits);
+
+        object = cache::store(key, tmp, status);
+        if (object.empty())
+            object = tmp;
+    }
+
+    // Replay the output
+    last->OutputStream = target;
+    last->OutputMode = mode;
+    int in = open(object.c_str(), O_RDONLY);
+    int out = target.empty() ? STDOUT_FILENO : openStream(last, true);
+    if (in == -1 || out == -1)
+    {
+        perror(in == -1 ? object.c_str() : target.c_str());
+        status = 1;
+    }
+    else
+    {
+        std::cout << std::flush;
+        utility::copyFd(in, out);
+    }
+
+    if (in != -1)
+        close(in);
+    if (out != -1 && out != STDOUT_FILENO)
+        close(out);
+    if (object.find("/objects/tmp.") != std::string::npos)
+        unlink(object.c_str());
+    if (!hit)
+        cache::evict();
+    return status;
+}
+
+/**
+ * Following function performs the  task  of 
+ * handling  the  execution of each  of  the 
+ * command block, which the largest unit  in
+ * the parse tree. The function makes use of
+ * the execute_block function  for  handling 
+ * the execution of each block stored in it.
+ * 
+ * The blocks are joined by &&, so the first
+ * block that fails stops the command.
+ * 
+ * tail tells that nothing runs after this 
+ * command, its last block may then replace 
+ * the shell.
+ */
+int executors::execute(Command *c, bool tail)
+{
+    int exec_val = 0;
+    for (const auto &blk : c->Blocks)
+    {
+        exec_val = execute_block(blk, nullptr, tail && blk == c->Blocks.back());
+        if (exec_val != 0)
+            break;
+    }
+    return exec_val;
+}
+
+/**
+ * Following function calls a shell function 
+ * with the given arguments as its positional 
+ * parameters, $? is the status of the return 
+ * statement or of the last command run.
+ */
+int executors::call(const std::shared_ptr<Program> &fn, std::vector<std::string> &args)
+{
+    // Hold a reference, the function may redefine itself
+    std::shared_ptr<Program> body = fn;
+    positional.push_back(args);
+    int exec_val = run(body.get());
+    positional.pop_back();
+    return exec_val;
+}
+
+/**
+ * The following  function  is  the interpreter 
+ * for the compiled programs. It walks the list 
+ * of operations  with a program counter, loop 
+ * bodies are plain jumps backwards so nothing 
+ * is parsed again while a loop runs.
+ * 
+ * The word lists of the for loops live on  a 
+ * stack of frames local to this call, so the 
+ * same  program may be run recursively  (by 
+ * a function calling itself).
+ * 
+ * A ^C stops the program after the command 
+ * it interrupted, with status 130. 
+ * 
+ * With tail the program is all that is left 
+ * for the shell to do (a script or -c). Its 
+ * last operation ends the program when it is 
+ * reached, so a command run there is told so.
+ */
+int executors::run(Program *prog, bool tail)
+{
+    struct LoopFrame
+    {
+        std::vector<std::string> Words;
+        size_t Next;
+    };
+    std::vector<LoopFrame> loops;
+    static double events_seen = 0;
+
+    size_t pc = 0;
+    while (pc < prog->Ops.size())
+    {
+        Op &op = prog->Ops[pc++];
+        switch (op.Code)
+        {
+        case OP_RUN:
+            last_status = execute(op.Cmd, tail && pc == prog->Ops.size());
+            // A ^C or a finished job while a script runs, looked at every 10ms
+            if (utility::now() - events_seen > 0.01)
+            {
+                events::dispatch(0);
+                events_seen = utility::now();
+            }
+            // ^C ends the rest of the program, the line typed or the script
+            if (events::interrupted)
+                return last_status = 130;
+            break;
+        case OP_ASSIGN:
+            shell_vars[op.Name] = !op.Literal.empty() && op.Literal[0] ? op.Words[0] : utility::expand(op.Words[0]);
+            last_status = 0;
+            break;
+        case OP_JUMP:
+            pc = op.Target;
+            break;
+        case OP_JUMP_FALSE:
+            if (last_status != 0)
+                pc = op.Target;
+            break;
+        case OP_FOR_INIT:
+            loops.push_back({utility::expandWords(op.Words, op.Literal), 0});
+            break;
+        case OP_FOR_NEXT:
+            if (loops.back().Next == loops.back().Words.size())
+                pc = op.Target;
+            else
+                shell_vars[op.Name] = loops.back().Words[loops.back().Next++];
+            break;
+        case OP_LOOP_END:
+            loops.pop_back();
+            break;
+        case OP_DEFUN:
+            functions[op.Name] = op.Body;
+            last_status = 0;
+            break;
+        case OP_RETURN:
+            if (!op.Words.empty())
+                last_status = atoi(utility::expand(op.Words[0]).c_str());
+            return last_status;
+        }
+    }
+    return last_status;
+}
+
+/**
+ * The following function helps in pre  processing
+ * the string. This function is a utility function 
+ * specifically for the purpose of  parsing . This 
+ * function removes any white/space character from
+ * the beginning and the end of  the  string  thus 
+ * cleaning up the string  for  further processing
+ */
+std::string parser::trim(const std::string &trimStr)
+{
+    std::string str(trimStr);
+
+    // trim spaces from the front
+    std::reverse(str.begin(), str.end());
+    while (isspace(str.back()))
+        str.pop_back();
+
+    // trim spaces from the end
+    std::reverse(str.begin(), str.end());
+    while (isspace(str.back()))
+        str.pop_back();
+    return str;
+}
+
+/**
+ * Following funcion is a utility  function
+ * specifically for the purpose of  parsing 
+ * The function is used to split the string 
+ * as per the delimeter passed as  the  arg
+ * regexPattern. This function makes use of 
+ * the in-built regex library.
+ */
+std::vector<std::string> parser::splitString(const std::string &stringToSplit, const std::string &regexPattern)
+{
+    std::vector<std::string> result;
+
+    const std::regex rgx(regexPattern);
+
+    // -1 refers to capture all the substrings generated after splitting
+    std::sregex_token_iterator iter(stringToSplit.begin(), stringToSplit.end(), rgx, -1);
+
+    for (std::sregex_token_iterator end; iter != end; ++iter)
+    {
+        result.push_back(trim(iter->str()));
+    }
+
+    return result;
+}
+
+/**
+ * The following function splits words at the 
+ * spaces that are not quoted. The quotes are 
+ * removed, literal[i] tells whether words[i] 
+ * was single quoted.
+ */
+void parser::splitWords(const std::string &text, std::vector<std::string> &words, std::vector<bool> &literal)
+{
+    static const std::regex argRgx("((?:\"[^\"]*\")|(?:\'[^\']*\')|(?:[^ \'\"]+))");
+    std::string args = text;
+
+    std::smatch argMatches;
+    while (std::regex_search(args, argMatches, argRgx))
+    {
+        std::string s = argMatches[0].str();
+        bool single = s.length() > 0 && s[0] == '\'';
+        if (s.length() > 0 && (s[0] == '"' || s[0] == '\''))
+        {
+            s.erase(s.begin());
+            s.erase(s.end() - 1);
+        }
+        words.push_back(s);
+        literal.push_back(single);
+        args = argMatches.suffix().str();
+    }
+}
+
+/**
+ * The following function is the  main function
+ * responsible  for  parsing  the  atom command 
+ * statement  that  is  sent  as a  std::string 
+ * parameter  to the  function.  This  function 
+ * makes use of regex expressions for capturing 
+ * the different parts of the Atom object.
+ * 
+ * the regex experession captures the
+ * following groups :-
+ *  0  =>  Full string
+ *  1  =>  Runtime vars
+ *  2  =>  Program
+ *  3  =>  Args
+ *  4  =>  Redirects
+ * 
+ * With the help of the redirects the 
+ * function  sets  the values for the 
+ * Input Stream and the Output Stream
+ * 
+ * If redirect string length is 2,
+ * then as per the regex used  the 
+ * Output Mode will be  set  to  1 
+ * which is the append mode.
+ * 
+ * The  arguments   and  the  redirect 
+ * strings  that   were  captured  are 
+ * further passed  though  the  argRgx 
+ * and the redirRgx for capturing  the 
+ * values. Finally  using  the  values
+ * that were extracted using the regex
+ * expressions are  used  to  set  the 
+ * valus of the fields of atom object.
+ */
+Atom *parser::getAtom(std::string &cmd)
+{
+    Atom *atom = new Atom();
+    atom->OutputStream = "";
+    atom->InputStream = "";
+    atom->OutputMode = 0;
+
+    std::smatch matches;
+    std::regex rgx("((?:[a-zA-Z0-9-_]+=(?:(?:\"[^\"]*\")|(?:\'[^\']*\')|(?:[^ \'\"]*)) )*)([a-zA-Z0-9-_./\\[$]+)( [^><]*)? *((?:<|>>|>).*)?");
+
+    if (regex_search(cmd, matches, rgx))
+    {
+        atom->Program = trim(matches[2].str());
+        atom->InputStream = "";
+        atom->OutputStream = "";
+
+        std::string vars = trim(matches[1].str());
+        std::regex varRgx("(([a-zA-Z0-9-_]+)=((?:\"[^\"]*\")|(?:\'[^\']*\')|(?:[^ \'\"]*)))");
+        std::smatch varMatch;
+        while (std::regex_search(vars, varMatch, varRgx))
+        {
+            atom->RuntimeVars[varMatch[2].str()] = varMatch[3].str();
+            vars = varMatch.suffix().str();
+        }
+
+        splitWords(matches[3].str(), atom->Args, atom->Literal);
+
+        std::string redirs = trim(matches[4].str());
+        std::regex redirRgx("((?:<|>>|>) *[^ ><]*)");
+
+        std::smatch redirMatches;
+        while (std::regex_search(redirs, redirMatches, redirRgx))
+        {
+            std::string redirStr = redirMatches[0].str();
+            if (redirStr[0] == '<')
+            {
+                redirStr.erase(redirStr.begin());
+                redirStr = trim(redirStr);
+                if (redirStr.length() > 0)
+                    atom->InputStream = redirStr;
+            }
+            else
+            {
+                if (redirStr.length() >= 2)
+                {
+                    if (redirStr[1] == '>')
+                    {
+                        redirStr.erase(redirStr.begin());
+                        atom->OutputMode = 0;
+                    }
+                    else
+                    {
+                        atom->OutputMode = 1;
+                    }
+
+                    redirStr.erase(redirStr.begin());
+                    redirStr = trim(redirStr);
+                    if (redirStr.length() > 0)
+                        atom->OutputStream = redirStr;
+                }
+            }
+            redirs = redirMatches.suffix().str();
+            // Multiple matches will overwrite
+        }
+    }
+    return atom;
+}
+
+/**
+ * The following function splits a block into 
+ * atom strings at the '|' that are not quoted, 
+ * so that `alias l='ls | less'` stays one atom.
+ */
+std::vector<std::string> parser::splitPipes(const std::string &str)
+{
+    std::vector<std::string> result(1);
+    char quote = 0;
+    for (char c : str)
+    {
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+            quote = c;
+        else if (c == '|')
+        {
+            result.push_back("");
+            continue;
+        }
+        result.back() += c;
+    }
+
+    for (auto &atom : result)
+        atom = trim(atom);
+    return result;
+}
+
+/**
+ * The following function replaces the program 
+ * name at the start of an atom string by its 
+ * alias. The replacement is checked again, so 
+ * aliases may refer to other aliases, but a 
+ * name is never expanded twice (alias ls='ls 
+ * -F' terminates). Like in other shells the 
+ * aliases are applied when a line is parsed, an 
+ * alias is not seen by the rest of the source 
+ * that defines it.
+ */
+std::string parser::expandAlias(const std::string &atom)
+{
+    std::string str = trim(atom);
+    std::set<std::string> seen;
+    while (true)
+    {
+        size_t end = str.find_first_of(" \t");
+        std::string word = str.substr(0, end);
+        auto it = aliases.find(word);
+        if (it == aliases.end() || !seen.insert(word).second)
+            return str;
+        str = it->second + (end == std::string::npos ? "" : str.substr(end));
+    }
+}
+
+/**
+ * The following function is the main
+ * function that handles the  parsing  
+ * of the  block  statements that are 
+ * passed as a std::string parameter.
+ * 
+ * getBlock make use of  the  getAtom 
+ * utility  function  in  the  parser 
+ * namespace that for further parsing
+ * and creating of  the Atom  objects
+ * 
+ * The  IsBackgroundProcess  is a boolean
+ * field which keeps track of whether the 
+ * code is to be run in the background or 
+ * not. 
+ * 
+ * The split pipes command is used
+ * to split the  block  string into 
+ * atom string. The  atom  string do 
+ * not contain any  "|" hence we use
+ * "|"  as  the  delimiter  for  the 
+ * splitting of string. "|" -> PIPE
+ * 
+ * The aliases are expanded here, per
+ * atom, before it is parsed.
+ */
+Block *parser::getBlock(std::string &cmd)
+{
+    Block *blk = new Block();
+    if (*(cmd.end() - 1) == '&')
+    {
+        // Background process
+        blk->IsBackgroundProcess = true;
+        cmd.erase(cmd.end() - 1);
+    }
+    else
+    {
+        blk->IsBackgroundProcess = false;
+    }
+
+    cmd = trim(cmd);
+
+    auto singles = splitPipes(cmd);
+    for (auto s : singles)
+    {
+        if (aliases.empty())
+        {
+            blk->Atoms.push_back(getAtom(s));
+            continue;
+        }
+
+        // The value of an alias may itself be a pipeline
+        for (auto t : splitPipes(expandAlias(s)))
+            blk->Atoms.push_back(getAtom(t));
+    }
+
+    return blk;
+}
+
+/**
+ * The following function is the main
+ * function that handles the  parsing  
+ * of the command statements that are 
+ * passed as a std::string parameter.
+ * 
+ * Parse  make use  of  the  getBlock 
+ * utility  function  in  the  parser 
+ * namespace that for further parsing
+ * and creating of the block  objects
+ * 
+ * The split string command is used
+ * to split the command string into 
+ * block string. The block string do 
+ * not contain any "&&" hence we use
+ * "&&"  as  the  delimiter  for the 
+ * splitting of string.
+ */
+Command *parser::Parse(const std::string &cmd)
+{
+    auto singles = splitString(cmd, "&&");
+    Command *cmds = new Command();
+    for (auto &s : singles)
+    {
+        cmds->Blocks.push_back(getBlock(s));
+    }
+    return cmds;
+}
+
+/**
+ * The following function splits shell source 
+ * into  statements.  Statements end at a new 
+ * line or at a ';' that is not quoted. Lines 
+ * starting with '#' are comments.
+ * 
+ * Keywords that may be followed by a command 
+ * on the same line (do, then, else, {)  and 
+ * function headers are split off so that the 
+ * compiler sees every keyword on its own:
+ * 
+ *  >>> f() { echo $1; }
+ *  >>> "f()"  "{"  "echo $1"  "}"
+ */
+std::vector<std::string> compiler::splitStatements(const std::string &src)
+{
+    static const std::regex funcRgx("^(?:function +)?([a-zA-Z_][a-zA-Z0-9_]*) *\\( *\\) *(.*)$");
+    static const std::regex funcKwRgx("^function +([a-zA-Z_][a-zA-Z0-9_]*) *(.*)$");
+
+    std::vector<std::string> raw, statements;
+    std::string current;
+    char quote = 0;
+    for (size_t i = 0; i < src.length(); i++)
+    {
+        char c = src[i];
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '\'' || c == '"')
+        {
+            quote = c;
+        }
+        else if (c == '#' && parser::trim(current).empty())
+        {
+            while (i + 1 < src.length() && src[i + 1] != '\n')
+                i++;
+            continue;
+        }
+        else if (c == ';' || c == '\n')
+        {
+            raw.push_back(current);
+            current.clear();
+            continue;
+        }
+        current += c;
+    }
+    raw.push_back(current);
+
+    for (auto &r : raw)
+    {
+        std::string stmt = parser::trim(r);
+        while (!stmt.empty())
+        {
+            std::smatch m;
+            if (std::regex_match(stmt, m, funcRgx) || std::regex_match(stmt, m, funcKwRgx))
+            {
+                statements.push_back(m[1].str() + "()");
+                stmt = parser::trim(m[2].str());
+                continue;
+            }
+
+            std::string word = stmt.substr(0, stmt.find(' '));
+            if (word == "{" || word == "do" || word == "then" || word == "else")
+            {
+                statements.push_back(word);
+                stmt = parser::trim(stmt.substr(word.length()));
+                continue;
+            }
+
+            statements.push_back(stmt);
+            break;
+        }
+    }
+    return statements;
+}
+
+/**
+ * Cheap check used by the interactive loop to
+ * decide whether more lines are needed before 
+ * the source is compiled: every if, for, while 
+ * and { must have been closed.
+ */
+bool compiler::isComplete(const std::string &src)
+{
+    int depth = 0;
+    for (auto &stmt : splitStatements(src))
+    {
+        std::string word = stmt.substr(0, stmt.find(' '));
+        if (word == "if" || word == "for" || word == "while" || word == "{")
+            depth++;
+        else if (word == "fi" || word == "done" || word == "}")
+            depth--;
+    }
+    return depth <= 0;
+}
+
+/**
+ * The following function compiles statements 
+ * into prog until one  of  the  terminators 
+ * (for example "fi" or "done") is reached. The 
+ * terminator that ended the list is returned, 
+ * "" when the source ran out.
+ * 
+ * Compilation is top down like the parser:
+ * 
+ * if C; then A; elif D; then B; else E; fi
+ *      RUN C, JUMP_FALSE -> l1, A, JUMP -> end
+ *  l1: RUN D, JUMP_FALSE -> l2, B, JUMP -> end
+ *  l2: E
+ * end:
+ * 
+ * while C; do A; done
+ *   l: RUN C, JUMP_FALSE -> end, A, JUMP -> l
+ * end:
+ * 
+ * for V in W; do A; done
+ *      FOR_INIT W
+ *   l: FOR_NEXT V -> end, A, JUMP -> l
+ * end: LOOP_END
+ * 
+ * NAME() { A; }
+ *      DEFUN NAME, A compiled on its own
+ */
+std::string compiler::compileList(Source &src, Program *prog, const std::vector<std::string> &terminators)
+{
+    static const std::regex assignRgx("^([a-zA-Z_][a-zA-Z0-9_]*)=((?:\"[^\"]*\")|(?:'[^']*')|(?:[^ '\"]*))$");
+    static const std::vector<std::string> keywords = {"then", "elif", "else", "fi", "do", "done", "{", "}"};
+
+    auto emit = [&](OpCode code) -> Op & {
+        prog->Ops.push_back(Op());
+        prog->Ops.back().Code = code;
+        prog->Ops.back().Cmd = nullptr;
+        prog->Ops.back().Target = 0;
+        return prog->Ops.back();
+    };
+    auto fail = [&](const std::string &error) {
+        if (src.Status == COMPLETE)
+        {
+            src.Status = ERROR;
+            src.Error = error;
+        }
+        return std::string();
+    };
+    // The next statement must be the given keyword
+    auto expect = [&](const std::string &keyword) {
+        if (src.Pos == src.Statements.size())
+        {
+            src.Status = INCOMPLETE;
+            return false;
+        }
+        if (src.Statements[src.Pos] != keyword)
+        {
+            fail("expected '" + keyword + "' near '" + src.Statements[src.Pos] + "'");
+            return false;
+        }
+        src.Pos++;
+        return true;
+    };
+
+    while (src.Pos < src.Statements.size() && src.Status == COMPLETE)
+    {
+        std::string stmt = src.Statements[src.Pos++];
+        std::string word = stmt.substr(0, stmt.find(' '));
+        std::string rest = stmt.length() > word.length() ? parser::trim(stmt.substr(word.length())) : "";
+
+        if (std::find(terminators.begin(), terminators.end(), word) != terminators.end())
+            return word;
+        if (std::find(keywords.begin(), keywords.end(), word) != keywords.end())
+            return fail("unexpected '" + word + "'");
+
+        std::smatch m;
+        if (word == "if")
+        {
+            std::vector<size_t> ends;
+            std::string term = "elif";
+            while (term == "elif")
+            {
+                if (rest.empty())
+                    return fail("missing condition");
+                emit(OP_RUN).Cmd = parser::Parse(rest);
+                size_t jf = prog->Ops.size();
+                emit(OP_JUMP_FALSE);
+                if (!expect("then"))
+                    return "";
+
+                term = compileList(src, prog, {"elif", "else", "fi"});
+                if (term.empty())
+                    return "";
+                if (term != "fi")
+                {
+                    ends.push_back(prog->Ops.size());
+                    emit(OP_JUMP);
+                }
+                prog->Ops[jf].Target = prog->Ops.size();
+
+                if (term == "elif")
+                    rest = parser::trim(src.Statements[src.Pos - 1].substr(4));
+            }
+            if (term == "else" && compileList(src, prog, {"fi"}).empty())
+                return "";
+            for (auto &e : ends)
+                prog->Ops[e].Target = prog->Ops.size();
+        }
+        else if (word == "while")
+        {
+            if (rest.empty())
+                return fail("missing condition");
+            size_t loop = prog->Ops.size();
+            emit(OP_RUN).Cmd = parser::Parse(rest);
+            size_t jf = prog->Ops.size();
+            emit(OP_JUMP_FALSE);
+            if (!expect("do"))
+                return "";
+
+            src.Breaks.push_back({jf});
+            src.Continues.push_back(loop);
+            std::string term = compileList(src, prog, {"done"});
+            src.Continues.pop_back();
+            std::vector<size_t> breaks = src.Breaks.back();
+            src.Breaks.pop_back();
+            if (term.empty())
+                return "";
+
+            emit(OP_JUMP).Target = loop;
+            for (auto &b : breaks)
+                prog->Ops[b].Target = prog->Ops.size();
+        }
+        else if (word == "for")
+        {
+            std::vector<std::string> words;
+            std::vector<bool> literal;
+            parser::splitWords(rest, words, literal);
+            if (words.empty() || words[0].empty())
+                return fail("missing loop variable");
+            std::string var = words[0];
+            words.erase(words.begin());
+            literal.erase(literal.begin());
+            if (words.empty())
+            {
+                words.push_back("$@");
+                literal.push_back(false);
+            }
+            else if (words[0] == "in")
+            {
+                words.erase(words.begin());
+                literal.erase(literal.begin());
+            }
+            else
+                return fail("expected 'in' after 'for " + var + "'");
+
+            Op &init = emit(OP_FOR_INIT);
+            init.Words = words;
+            init.Literal = literal;
+            size_t loop = prog->Ops.size();
+            emit(OP_FOR_NEXT).Name = var;
+            if (!expect("do"))
+                return "";
+
+            src.Breaks.push_back({});
+            src.Continues.push_back(loop);
+            std::string term = compileList(src, prog, {"done"});
+            src.Continues.pop_back();
+            std::vector<size_t> breaks = src.Breaks.back();
+            src.Breaks.pop_back();
+            if (term.empty())
+                return "";
+
+            emit(OP_JUMP).Target = loop;
+            prog->Ops[loop].Target = prog->Ops.size();
+            for (auto &b : breaks)
+                prog->Ops[b].Target = prog->Ops.size();
+            emit(OP_LOOP_END);
+        }
+        else if (word.length() > 2 && word.compare(word.length() - 2, 2, "()") == 0)
+        {
+            if (!expect("{"))
+                return "";
+
+            // break / continue never cross a function boundary
+            Source body = {src.Statements, src.Pos, COMPLETE, "", {}, {}};
+            std::shared_ptr<Program> fn = std::make_shared<Program>();
+            std::string term = compileList(body, fn.get(), {"}"});
+            src.Pos = body.Pos;
+            if (body.Status != COMPLETE)
+            {
+                src.Status = body.Status;
+                src.Error = body.Error;
+                return "";
+            }
+            if (term.empty())
+            {
+                src.Status = INCOMPLETE;
+                return "";
+            }
+
+            Op &op = emit(OP_DEFUN);
+            op.Name = word.substr(0, word.length() - 2);
+            op.Body = fn;
+        }
+        else if (word == "break" || word == "continue")
+        {
+            if (src.Continues.empty())
+                return fail("'" + word + "' outside of a loop");
+            if (word == "break")
+                src.Breaks.back().push_back(prog->Ops.size());
+            emit(OP_JUMP).Target = src.Continues.back();
+        }
+        else if (word == "return")
+        {
+            Op &op = emit(OP_RETURN);
+            if (!rest.empty())
+                op.Words.push_back(rest);
+        }
+        else if (std::regex_match(stmt, m, assignRgx))
+        {
+            std::string value = m[2].str();
+            bool literal = value.length() > 1 && value[0] == '\'';
+            if (value.length() > 1 && (value[0] == '"' || value[0] == '\''))
+                value = value.substr(1, value.length() - 2);
+            Op &op = emit(OP_ASSIGN);
+            op.Name = m[1].str();
+            op.Words.push_back(value);
+            op.Literal.push_back(literal);
+        }
+        else
+        {
+            emit(OP_RUN).Cmd = parser::Parse(stmt);
+        }
+    }
+
+    if (src.Status == COMPLETE && !terminators.empty())
+        src.Status = INCOMPLETE;
+    return "";
+}
+
+/**
+ * The following function is the entry point of 
+ * the compiler. On success the compiled program 
+ * is returned and state is COMPLETE, otherwise 
+ * state is INCOMPLETE (a construct is still open) 
+ * or ERROR with the message stored in error.
+ */
+Program *compiler::Compile(const std::string &text, State &state, std::string &error)
+{
+    Source src = {splitStatements(text), 0, COMPLETE, "", {}, {}};
+    Program *prog = new Program();
+    compileList(src, prog, {});
+
+    state = src.Status;
+    error = src.Error;
+    if (state != COMPLETE)
+    {
+        delete prog;
+        return nullptr;
+    }
+    return prog;
+}
+
+/**
+ * FNV-1a over two lanes, the second lane sees 
+ * every byte rotated so that together they 
+ * give a 128 bit fingerprint.
+ */
+void cache::Hasher::update(const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = data[i];
+        Lanes[0] = (Lanes[0] ^ c) * 0x100000001b3ULL;
+        Lanes[1] = (Lanes[1] ^ (unsigned char)((c << 3) | (c >> 5))) * 0x100000001b3ULL;
+    }
+}
+
+// Fields are length prefixed so that "ab","c" != "a","bc"
+void cache::Hasher::update(const std::string &str)
+{
+    uint64_t len = str.length();
+    update((const char *)&len, sizeof(len));
+    update(str.data(), str.length());
+}
+
+std::string cache::Hasher::hex() const
+{
+    char buff[33];
+    snprintf(buff, sizeof(buff), "%016llx%016llx", (unsigned long long)Lanes[0], (unsigned long long)Lanes[1]);
+    return buff;
+}
+
+/**
+ * Following function returns the directory of 
+ * the cache store and creates it (with the 
+ * objects/ and entries/ sub directories) when 
+ * it does not exist yet.
+ */
+std::string cache::storeDir()
+{
+    std::string dir = utility::lookupVar("DMSH_CACHE_DIR");
+    if (dir.empty())
+    {
+        std::string base = utility::lookupVar("XDG_CACHE_HOME");
+        if (base.empty())
+            base = utility::lookupVar("HOME") + "/.cache";
+        dir = base + "/dmsh";
+    }
+
+    for (size_t pos = 1; pos != std::string::npos; pos = dir.find('/', pos + 1))
+        mkdir(dir.substr(0, pos).c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/objects").c_str(), 0755);
+    mkdir((dir + "/entries").c_str(), 0755);
+    return dir;
+}
+
+/**
+ * The following function fingerprints an input 
+ * file. Small regular files are hashed by their 
+ * content, anything else by its inode, size and 
+ * mtime.
+ */
+std::string cache::fingerprint(const std::string &path)
+{
+    const off_t content_limit = 4 << 20;
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        return "missing";
+
+    if (S_ISREG(st.st_mode) && st.st_size <= content_limit)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1)
+        {
+            Hasher h;
+            char buff[65536];
+            ssize_t n;
+            while ((n = read(fd, buff, sizeof(buff))) > 0)
+                h.update(buff, n);
+            close(fd);
+            if (n == 0)
+                return "c:" + h.hex();
+        }
+    }
+    return "m:" + std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" +
+           std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+}
+
+/**
+ * Following function computes the key of a 
+ * block: everything that decides its output.
+ */
+std::string cache::key(Block *b, const std::vector<std::string> &inputs, const std::vector<std::string> &vars)
+{
+    Hasher h;
+    char *cwd = getcwd(nullptr, 0);
+    h.update(cwd ? cwd : "");
+    free(cwd);
+    h.update(utility::lookupVar("PATH"));
+
+    for (auto &atom : b->Atoms)
+    {
+        h.update("atom");
+        h.update(atom->Program);
+        for (auto &arg : atom->Args)
+            h.update(arg);
+        for (auto &var : atom->RuntimeVars)
+            h.update(var.first + "=" + var.second);
+        if (!atom->InputStream.empty())
+            h.update("<" + atom->InputStream + ":" + fingerprint(atom->InputStream));
+        if (!atom->OutputStream.empty() && atom != b->Atoms.back())
+            h.update(">" + atom->OutputStream);
+    }
+    for (auto &input : inputs)
+        h.update("-i" + input + ":" + fingerprint(input));
+    for (auto &var : vars)
+        h.update("-e" + var + "=" + utility::lookupVar(var));
+    return h.hex();
+}
+
+/**
+ * Looks up the entry of key, on a hit the path 
+ * of the stored output and the exit status are 
+ * returned and the object is marked as used.
+ */
+bool cache::lookup(const std::string &key, std::string &object, int &status)
+{
+    std::string dir = storeDir();
+    std::string path = dir + "/entries/" + key;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && time(NULL) - st.st_mtime > maxAge())
+    {
+        unlink(path.c_str());
+        return false;
+    }
+
+    std::ifstream entry(path);
+    std::string hash;
+    if (!(entry >> hash >> status))
+        return false;
+
+    object = dir + "/objects/" + hash;
+    if (utimensat(AT_FDCWD, object.c_str(), NULL, 0) == -1)
+    {
+        // The object was evicted
+        unlink((dir + "/entries/" + key).c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The following function moves the captured 
+ * output tmp into the store under the hash of 
+ * its content and records the entry of key. 
+ * Only a status of 0 is stored, a failure may 
+ * be transient. Returns the object path or "".
+ * The caller runs evict once it has replayed 
+ * the object.
+ */
+std::string cache::store(const std::string &key, const std::string &tmp, int status)
+{
+    if (status != 0)
+        return "";
+
+    std::string hash = fingerprint(tmp);
+    hash = hash.substr(hash.find(':') + 1);
+    if (hash.find(':') != std::string::npos)
+    {
+        // Too large to be hashed while fingerprinting
+        Hasher h;
+        h.update(hash);
+        hash = h.hex();
+    }
+
+    std::string dir = storeDir();
+    std::string object = dir + "/objects/" + hash;
+    if (rename(tmp.c_str(), object.c_str()) == -1)
+        return "";
+
+    std::ofstream entry(dir + "/entries/" + key);
+    entry << hash << " " << status << std::endl;
+    return object;
+}
+
+// Seconds an entry stays valid, $DMSH_CACHE_AGE
+double cache::maxAge()
+{
+    std::string age_var = utility::lookupVar("DMSH_CACHE_AGE");
+    double age;
+    if (age_var.empty() || !utility::parseDuration(age_var, age))
+        age = 7 * 86400;
+    return age;
+}
+
+// Bytes the objects may take, $DMSH_CACHE_SIZE
+long long cache::maxSize()
+{
+    std::string limit_var = utility::lookupVar("DMSH_CACHE_SIZE");
+    long long limit;
+    if (limit_var.empty() || !utility::parseSize(limit_var, limit))
+        limit = 256LL << 20;
+    return limit;
+}
+
+/**
+ * Following function removes the least recently 
+ * used objects until the store fits in 
+ * $DMSH_CACHE_SIZE bytes, then the entries that 
+ * expired or lost their object.
+ */
+void cache::evict()
+{
+    long long limit = maxSize();
+    std::string dir = storeDir() + "/objects/";
+
+    std::vector<std::pair<struct timespec, std::pair<std::string, off_t>>> objects;
+    long long total = 0;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+        return;
+    for (struct dirent *e; (e = readdir(d)) != nullptr;)
+    {
+        struct stat st;
+        std::string name = e->d_name;
+        if (name[0] == '.' || name.compare(0, 4, "tmp.") == 0 || stat((dir + name).c_str(), &st) == -1)
+            continue;
+        objects.push_back({st.st_mtim, {name, st.st_size}});
+        total += st.st_size;
+    }
+    closedir(d);
+
+    std::sort(objects.begin(), objects.end(), [](const auto &l, const auto &r) {
+        return l.first.tv_sec != r.first.tv_sec ? l.first.tv_sec < r.first.tv_sec : l.first.tv_nsec < r.first.tv_nsec;
+    });
+    for (size_t i = 0; i < objects.size() && total > limit; i++)
+    {
+        unlink((dir + objects[i].second.first).c_str());
+        total -= objects[i].second.second;
+    }
+
+    std::string entries = storeDir() + "/entries/";
+    time_t now = time(NULL);
+    double age = maxAge();
+    d = opendir(entries.c_str());
+    if (d == nullptr)
+        return;
+    for (struct dirent *e; (e = readdir(d)) != nullptr;)
+    {
+        struct stat st;
+        std::string name = e->d_name, hash;
+        if (name[0] == '.' || stat((entries + name).c_str(), &st) == -1)
+            continue;
+        std::ifstream entry(entries + name);
+        if (now - st.st_mtime > age || !(entry >> hash) || access((dir + hash).c_str(), F_OK) == -1)
+            unlink((entries + name).c_str());
+    }
+    closedir(d);
+}
+
+// Adds one hit or miss to the persistent counters
+void cache::count(bool hit)
+{
+    std::string path = storeDir() + "/stats";
+    long long hits = 0, misses = 0;
+    std::ifstream in(path);
+    in >> hits >> misses;
+    in.close();
+
+    (hit ? hits : misses)++;
+    std::ofstream out(path);
+    out << hits << " " << misses << std::endl;
+}
+
+/**
+ * The following function prints the state of 
+ * the store: entries, objects, their size 
+ * against the limit and the hit rate.
+ */
+int cache::stats()
+{
+    std::string dir = storeDir();
+    long long hits = 0, misses = 0, bytes = 0, objects = 0, entries = 0;
+    std::ifstream in(dir + "/stats");
+    in >> hits >> misses;
+
+    for (std::string sub : {"/objects/", "/entries/"})
+    {
+        DIR *d = opendir((dir + sub).c_str());
+        for (struct dirent *e; d != nullptr && (e = readdir(d)) != nullptr;)
+        {
+            struct stat st;
+            if (e->d_name[0] == '.' || stat((dir + sub + e->d_name).c_str(), &st) == -1)
+                continue;
+            if (sub == "/objects/")
+            {
+                objects++;
+                bytes += st.st_size;
+            }
+            else
+            {
+                entries++;
+            }
+        }
+        if (d != nullptr)
+            closedir(d);
+    }
+
+    std::cout << "store:    " << dir << std::endl
+              << "entries:  " << entries << std::endl
+              << "objects:  " << objects << " (" << bytes << " of " << maxSize() << " bytes)" << std::endl
+              << "hits:     " << hits << std::endl
+              << "misses:   " << misses << std::endl
+              << "hit rate: " << std::fixed << std::setprecision(1)
+              << (hits + misses ? 100.0 * hits / (hits + misses) : 0.0) << "%" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+    return 0;
+}
+
+// Removes every entry and object, resets the counters
+int cache::clear()
+{
+    std::string dir = storeDir();
+    for (std::string sub : {"/objects/", "/entries/"})
+    {
+        DIR *d = opendir((dir + sub).c_str());
+        for (struct dirent *e; d != nullptr && (e = readdir(d)) != nullptr;)
+            if (e->d_name[0] != '.')
+                unlink((dir + sub + e->d_name).c_str());
+        if (d != nullptr)
+            closedir(d);
+    }
+    unlink((dir + "/stats").c_str());
+    return 0;
+}
+
+/**
+ * The following function puts a background job 
+ * under the watch of the watchdog thread, which 
+ * is started with the first watched job. The 
+ * job is dropped once all of its processes 
+ * have exited.
+ */
+void watchdog::add(pid_t pgid, const std::vector<pid_t> &pids, const Limits &limits)
+{
+    Watch watch = {pgid, timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC), limits.KillAfter, false, {}};
+    if (watch.Timer == -1)
+        return;
+    for (auto &pid : pids)
+    {
+        int fd = syscall(SYS_pidfd_open, pid, 0);
+        if (fd >= 0)
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            watch.Pidfds.push_back(fd);
+        }
+    }
+    utility::armTimer(watch.Timer, limits.Timeout);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (wake == -1)
+    {
+        wake = eventfd(0, EFD_CLOEXEC);
+        std::thread(loop).detach();
+    }
+    watches.push_back(watch);
+    uint64_t one = 1;
+    if (write(wake, &one, sizeof(one)) == -1)
+        perror("watchdog");
+}
+
+/**
+ * Following function is the body of the watchdog 
+ * thread. It blocks in poll over the wake up 
+ * eventfd, the deadline timers and the pidfds of 
+ * every watched job. An expired timer escalates 
+ * SIGTERM -> SIGKILL on the process group, a 
+ * readable pidfd means that process has exited 
+ * (it is reaped by the shell, not here).
+ */
+void watchdog::loop()
+{
+    std::vector<struct pollfd> fds;
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            fds.assign(1, {wake, POLLIN, 0});
+            for (auto &watch : watches)
+            {
+                fds.push_back({watch.Timer, POLLIN, 0});
+                for (auto &fd : watch.Pidfds)
+                    fds.push_back({fd, POLLIN, 0});
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), -1) == -1)
+            continue;
+
+        std::lock_guard<std::mutex> guard(lock);
+        uint64_t count;
+        if ((fds[0].revents & POLLIN) && read(wake, &count, sizeof(count)) == -1)
+            continue;
+
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            for (auto &watch : watches)
+            {
+                if (watch.Timer == fds[i].fd)
+                {
+                    utility::escalate(watch.Pgid, watch.Timer, watch.Escalated, watch.KillAfter);
+                    break;
+                }
+                auto it = std::find(watch.Pidfds.begin(), watch.Pidfds.end(), fds[i].fd);
+                if (it != watch.Pidfds.end())
+                {
+                    close(*it);
+                    watch.Pidfds.erase(it);
+                    break;
+                }
+            }
+        }
+
+        for (auto it = watches.begin(); it != watches.end();)
+        {
+            if (it->Pidfds.empty())
+            {
+                close(it->Timer);
+                it = watches.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+}
+
+/**
+ * The following functions write the snapshot. 
+ * Integers are stored as 8 bytes in the host 
+ * order (a snapshot never leaves the machine), 
+ * strings and lists are length prefixed.
+ */
+void snapshot::Writer::u64(uint64_t n)
+{
+    Buff.append((const char *)&n, sizeof(n));
+}
+
+void snapshot::Writer::str(const std::string &s)
+{
+    u64(s.length());
+    Buff += s;
+}
+
+void snapshot::Writer::strs(const std::vector<std::string> &list)
+{
+    u64(list.size());
+    for (auto &s : list)
+        str(s);
+}
+
+void snapshot::Writer::table(const std::map<std::string, std::string> &map)
+{
+    u64(map.size());
+    for (auto &entry : map)
+    {
+        str(entry.first);
+        str(entry.second);
+    }
+}
+
+void snapshot::Writer::command(const Command *cmd)
+{
+    u64(cmd->Blocks.size());
+    for (auto &blk : cmd->Blocks)
+    {
+        u64(blk->IsBackgroundProcess);
+        u64(blk->Atoms.size());
+        for (auto &atom : blk->Atoms)
+        {
+            table(atom->RuntimeVars);
+            str(atom->Program);
+            strs(atom->Args);
+            u64(atom->Literal.size());
+            for (bool literal : atom->Literal)
+                u64(literal);
+            str(atom->InputStream);
+            str(atom->OutputStream);
+            u64(atom->OutputMode);
+        }
+    }
+}
+
+void snapshot::Writer::program(const Program *prog)
+{
+    u64(prog->Ops.size());
+    for (auto &op : prog->Ops)
+    {
+        u64(op.Code);
+        u64(op.Target);
+        str(op.Name);
+        strs(op.Words);
+        u64(op.Literal.size());
+        for (bool literal : op.Literal)
+            u64(literal);
+        u64(op.Cmd != nullptr);
+        if (op.Cmd)
+            command(op.Cmd);
+        u64(op.Body != nullptr);
+        if (op.Body)
+            program(op.Body.get());
+    }
+}
+
+/**
+ * The following functions read the snapshot back 
+ * from the mapping. Running past the end clears 
+ * Ok and yields empty values, the caller drops 
+ * everything that was read in that case.
+ */
+uint64_t snapshot::Reader::u64()
+{
+    uint64_t n = 0;
+    if (End - Pos < (ptrdiff_t)sizeof(n))
+    {
+        Ok = false;
+        return 0;
+    }
+    memcpy(&n, Pos, sizeof(n));
+    Pos += sizeof(n);
+    return n;
+}
+
+std::string snapshot::Reader::str()
+{
+    uint64_t len = u64();
+    if ((uint64_t)(End - Pos) < len)
+    {
+        Ok = false;
+        return "";
+    }
+    std::string s(Pos, len);
+    Pos += len;
+    return s;
+}
+
+std::vector<std::string> snapshot::Reader::strs()
+{
+    std::vector<std::string> list;
+    for (uint64_t n = u64(); Ok && n > 0; n--)
+        list.push_back(str());
+    return list;
+}
+
+std::map<std::string, std::string> snapshot::Reader::table()
+{
+    std::map<std::string, std::string> map;
+    for (uint64_t n = u64(); Ok && n > 0; n--)
+    {
+        std::string name = str();
+        map[name] = str();
+    }
+    return map;
+}
+
+Command *snapshot::Reader::command()
+{
+    Command *cmd = new Command();
+    for (uint64_t blocks = u64(); Ok && blocks > 0; blocks--)
+    {
+        Block *blk = new Block();
+        cmd->Blocks.push_back(blk);
+        blk->IsBackgroundProcess = u64();
+        for (uint64_t atoms = u64(); Ok && atoms > 0; atoms--)
+        {
+            Atom *atom = new Atom();
+            blk->Atoms.push_back(atom);
+            atom->RuntimeVars = table();
+            atom->Program = str();
+            atom->Args = strs();
+            for (uint64_t n = u64(); Ok && n > 0; n--)
+                atom->Literal.push_back(u64());
+            atom->InputStream = str();
+            atom->OutputStream = str();
+            atom->OutputMode = u64();
+        }
+    }
+    return cmd;
+}
+
+std::shared_ptr<Program> snapshot::Reader::program()
+{
+    std::shared_ptr<Program> prog = std::make_shared<Program>();
+    for (uint64_t n = u64(); Ok && n > 0; n--)
+    {
+        Op op = {};
+        uint64_t code = u64();
+        op.Code = (OpCode)code;
+        op.Target = u64();
+        op.Name = str();
+        op.Words = strs();
+        for (uint64_t n = u64(); Ok && n > 0; n--)
+            op.Literal.push_back(u64());
+        if (u64())
+            op.Cmd = command();
+        if (u64())
+            op.Body = program();
+        prog->Ops.push_back(op);
+        if (code > OP_RETURN || (op.Code == OP_RUN && op.Cmd == nullptr) || (op.Code == OP_DEFUN && op.Body == nullptr))
+            Ok = false;
+    }
+    return prog;
+}
+
+// The startup file, $DMSH_RC set to "" disables it
+std::string snapshot::rcPath()
+{
+    const char *rc = getenv("DMSH_RC");
+    if (rc)
+        return rc;
+    const char *home = getenv("HOME");
+    return home ? std::string(home) + "/.dmshrc" : "";
+}
+
+std::string snapshot::path(const std::string &rc)
+{
+    cache::Hasher h;
+    h.update(rc);
+    return cache::storeDir() + "/rc-" + h.hex() + ".snap";
+}
+
+/**
+ * The following function lists the variables 
+ * the rc text refers to ($NAME / ${NAME}). The 
+ * values the rc computes from them are frozen 
+ * in the snapshot, so their values at startup 
+ * are part of what validates it.
+ */
+std::vector<std::string> snapshot::references(const std::string &text)
+{
+    static const std::regex refRgx("\\$\\{?([A-Za-z_][A-Za-z0-9_]*)");
+    std::set<std::string> names;
+    for (std::sregex_iterator it(text.begin(), text.end(), refRgx), end; it != end; ++it)
+        names.insert((*it)[1].str());
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+std::string snapshot::envHash(const std::vector<std::string> &names)
+{
+    cache::Hasher h;
+    for (auto &name : names)
+    {
+        h.update(name);
+        h.update(utility::lookupVar(name));
+    }
+    return h.hex();
+}
+
+/**
+ * Following function tells whether running the 
+ * program only defines things: assignments, 
+ * functions and single export / alias / unalias 
+ * commands without redirections. Only then are 
+ * the tables all that running it leaves behind.
+ */
+bool snapshot::pure(const Program *prog)
+{
+    for (auto &op : prog->Ops)
+    {
+        if (op.Code == OP_ASSIGN || op.Code == OP_DEFUN)
+            continue;
+        if (op.Code != OP_RUN || op.Cmd->Blocks.size() != 1)
+            return false;
+
+        Block *blk = op.Cmd->Blocks[0];
+        if (blk->IsBackgroundProcess || blk->Atoms.size() != 1)
+            return false;
+        Atom *atom = blk->Atoms[0];
+        if (!atom->InputStream.empty() || !atom->OutputStream.empty() || !atom->RuntimeVars.empty())
+            return false;
+        if (atom->Program != "export" && atom->Program != "alias" && atom->Program != "unalias")
+            return false;
+    }
+    return true;
+}
+
+/**
+ * The following function installs the tables of 
+ * the snapshot of rc when it is still valid for 
+ * the rc described by st. The mtime and size are 
+ * compared first, when only they differ the rc 
+ * is hashed and a matching snapshot gets the new 
+ * mtime. Returns false when the rc has to be run.
+ */
+bool snapshot::load(const std::string &rc, const struct stat &st)
+{
+    int fd = open(path(rc).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat snap_st;
+    if (fstat(fd, &snap_st) == -1 || snap_st.st_size < (off_t)sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, snap_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, map, sizeof(header));
+    bool valid = memcmp(header.Magic, "DMSHSNAP", 8) == 0 && header.Version == VERSION && header.Size == st.st_size;
+    if (valid && (header.MtimeSec != st.st_mtim.tv_sec || header.MtimeNsec != st.st_mtim.tv_nsec))
+    {
+        // Touched, or really changed
+        std::ifstream in(rc);
+        std::stringstream buff;
+        buff << in.rdbuf();
+        cache::Hasher h;
+        h.update(buff.str());
+        valid = memcmp(header.RcHash, h.hex().data(), 32) == 0;
+        if (valid)
+        {
+            header.MtimeSec = st.st_mtim.tv_sec;
+            header.MtimeNsec = st.st_mtim.tv_nsec;
+            int out = open(path(rc).c_str(), O_WRONLY | O_CLOEXEC);
+            if (out != -1 && pwrite(out, &header, sizeof(header), 0) == -1)
+                perror("dmsh: rc snapshot");
+            if (out != -1)
+                close(out);
+        }
+    }
+    close(fd);
+
+    Reader reader = {(const char *)map + sizeof(Header), (const char *)map + snap_st.st_size, true};
+    std::vector<std::string> names = reader.strs();
+    valid = valid && reader.Ok && memcmp(header.EnvHash, envHash(names).data(), 32) == 0;
+    if (!valid)
+    {
+        munmap(map, snap_st.st_size);
+        return false;
+    }
+
+    auto vars = reader.table();
+    auto exports = reader.table();
+    auto aliased = reader.table();
+    std::map<std::string, std::shared_ptr<Program>> funcs;
+    for (uint64_t n = reader.u64(); reader.Ok && n > 0; n--)
+    {
+        std::string name = reader.str();
+        funcs[name] = reader.program();
+    }
+    valid = reader.Ok && reader.Pos == reader.End;
+    munmap(map, snap_st.st_size);
+    if (!valid)
+        return false;
+
+    for (auto &var : vars)
+        shell_vars[var.first] = var.second;
+    for (auto &entry : exports)
+        utility::exportVar(entry.second);
+    for (auto &entry : aliased)
+        aliases[entry.first] = entry.second;
+    for (auto &func : funcs)
+        functions[func.first] = func.second;
+    return true;
+}
+
+/**
+ * Following function writes the current tables 
+ * as the snapshot of rc, through a temporary 
+ * file so that a concurrent shell never maps a 
+ * half written snapshot.
+ */
+void snapshot::save(const std::string &rc, const struct stat &st, const std::string &text)
+{
+    std::vector<std::string> names = references(text);
+    cache::Hasher h;
+    h.update(text);
+
+    Header header = {};
+    memcpy(header.Magic, "DMSHSNAP", 8);
+    header.Version = VERSION;
+    header.MtimeSec = st.st_mtim.tv_sec;
+    header.MtimeNsec = st.st_mtim.tv_nsec;
+    header.Size = st.st_size;
+    memcpy(header.RcHash, h.hex().data(), 32);
+    memcpy(header.EnvHash, envHash(names).data(), 32);
+
+    Writer w;
+    w.Buff.append((const char *)&header, sizeof(header));
+    w.strs(names);
+    w.table(shell_vars);
+    w.table(exported_env);
+    w.table(aliases);
+    w.u64(functions.size());
+    for (auto &func : functions)
+    {
+        w.str(func.first);
+        w.program(func.second.get());
+    }
+
+    std::string dest = path(rc), tmp = dest + ".tmp." + std::to_string(getpid());
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(w.Buff.data(), w.Buff.size());
+    out.close();
+    if (!out || rename(tmp.c_str(), dest.c_str()) == -1)
+        unlink(tmp.c_str());
+}
+
+/**
+ * The following function runs at startup. The 
+ * snapshot is used when it is valid, otherwise 
+ * the rc is compiled and run. The output of a 
+ * pure rc is only the echo of export, which is 
+ * dropped so that a cold start prints the same 
+ * as a warm one.
+ */
+void snapshot::startup()
+{
+    std::string rc = rcPath();
+    struct stat st;
+    if (rc.empty() || stat(rc.c_str(), &st) == -1 || load(rc, st))
+        return;
+
+    std::ifstream in(rc);
+    std::stringstream buff;
+    buff << in.rdbuf();
+    std::string text = buff.str();
+
+    compiler::State state;
+    std::string error;
+    Program *program = compiler::Compile(text, state, error);
+    if (state != compiler::COMPLETE)
+    {
+        std::cerr << "dmsh: " << rc << ": syntax error: " << error << std::endl;
+        delete program;
+        return;
+    }
+
+    bool clean = pure(program);
+    int saved_out = -1, null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (clean && null_fd != -1)
+    {
+        std::cout.flush();
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(null_fd, STDOUT_FILENO);
+    }
+    if (null_fd != -1)
+        close(null_fd);
+
+    executors::run(program);
+    last_status = 0;
+
+    if (saved_out != -1)
+    {
+        std::cout.flush();
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+
+    if (clean)
+        save(rc, st, text);
+    else
+        unlink(path(rc).c_str());
+    delete program;
+}
+
+/**
+ * Following function tells whether the atom runs 
+ * PROGRAM as the shell knows it (no function or 
+ * loaded builtin of that name) with its stdin 
+ * and environment left alone, so that a pass may 
+ * take its place.
+ */
+bool optimizer::plain(const Atom *a, const std::string &prog)
+{
+    return a->Program == prog && a->RuntimeVars.empty() && a->InputStream.empty() && a->HereString.empty() &&
+           functions.count(prog) == 0 && builtin::loaded.count(builtin::normalize(prog)) == 0;
+}
+
+// Whether the atom is forked, a builtin or function last in a block runs in the shell
+bool optimizer::external(const Atom *a)
+{
+    return !a->Program.empty() && functions.count(a->Program) == 0 && builtin::find(a->Program) == nullptr;
+}
+
+// The block as it would be written, for the trace
+std::string optimizer::render(const Block *b)
+{
+    std::string str;
+    for (auto &a : b->Atoms)
+    {
+        if (!str.empty())
+            str += " | ";
+        for (auto &var : a->RuntimeVars)
+            str += var.first + "=" + var.second + " ";
+        str += a->Program;
+        for (auto &arg : a->Args)
+            str += " " + arg;
+        if (!a->InputStream.empty())
+            str += " < " + a->InputStream;
+        if (!a->HereString.empty())
+            str += " <<< '" + a->HereString.substr(0, a->HereString.length() - 1) + "'";
+        if (!a->OutputStream.empty())
+            str += (a->OutputMode ? " > " : " >> ") + a->OutputStream;
+    }
+    return str + (b->IsBackgroundProcess ? " &" : "");
+}
+
+/**
+ * The following function applies the enabled 
+ * passes to the (already expanded) block. The 
+ * block itself is never changed, a rewritten 
+ * copy is built in out and returned instead. 
+ * dropped_cat is set when a trailing cat was 
+ * removed, the caller then reports the status 
+ * cat would have had.
+ */
+Block *optimizer::rewrite(Block *b, Block &out, bool &dropped_cat)
+{
+    std::vector<Atom *> &atoms = b->Atoms;
+    if (atoms.size() < 2 || atoms[0]->Program == "cached" || atoms[0]->Program == "timeout")
+        return b;
+
+    Atom *head = atoms[0], *next = atoms[1], *tail = atoms.back(), *prev = atoms[atoms.size() - 2];
+    bool feeds = head->OutputStream.empty() && next->InputStream.empty() && next->HereString.empty();
+    struct stat st;
+
+    bool cat_in = (enabled & CAT_IN) && feeds && plain(head, "cat") && head->Args.size() == 1 &&
+                  !head->Args[0].empty() && head->Args[0][0] != '-' && stat(head->Args[0].c_str(), &st) == 0 &&
+                  S_ISREG(st.st_mode) && access(head->Args[0].c_str(), R_OK) == 0;
+    bool echo_feed = (enabled & ECHO_FEED) && feeds && plain(head, "echo") &&
+                     (head->Args.empty() || head->Args[0].length() <= 1 || head->Args[0][0] != '-');
+    // cat changes nothing but the terminal check of the stage before it
+    bool cat_out = (enabled & CAT_OUT) && plain(tail, "cat") && tail->Args.empty() && prev->OutputStream.empty() &&
+                   (!tail->OutputStream.empty() || !isatty(STDOUT_FILENO)) && !(atoms.size() == 2 && (cat_in || echo_feed)) &&
+                   external(prev);
+    // The stage left last must still be forked (cd / | cat would move cd into the shell)
+    if (!external(cat_out ? prev : tail))
+        cat_in = echo_feed = false;
+    if (!cat_in && !echo_feed && !cat_out)
+        return b;
+
+    out.IsBackgroundProcess = b->IsBackgroundProcess;
+    for (auto &atom : atoms)
+        out.Atoms.push_back(new Atom(*atom));
+
+    std::string passes;
+    if (cat_in || echo_feed)
+    {
+        Atom *feeder = out.Atoms[0];
+        if (cat_in)
+            out.Atoms[1]->InputStream = feeder->Args[0];
+        else
+        {
+            std::string text;
+            for (auto &arg : feeder->Args)
+                text += (text.empty() ? "" : " ") + arg;
+            out.Atoms[1]->HereString = text + "\n";
+        }
+        delete feeder;
+        out.Atoms.erase(out.Atoms.begin());
+        passes = cat_in ? "cat-in" : "echo-feed";
+    }
+    if (cat_out)
+    {
+        Atom *cat = out.Atoms.back();
+        out.Atoms.pop_back();
+        out.Atoms.back()->OutputStream = cat->OutputStream;
+        out.Atoms.back()->OutputMode = cat->OutputMode;
+        delete cat;
+        dropped_cat = true;
+        passes += passes.empty() ? "cat-out" : ", cat-out";
+    }
+
+    if (trace)
+        std::cerr << "dmsh: optimize: " << passes << ": " << render(b) << "  =>  " << render(&out) << std::endl;
+    return &out;
+}
+
+/**
+ * The following function starts capturing the 
+ * output of a background job from the read end 
+ * of its pipe, under the pid of its first stage. 
+ * The reader thread is started with the first job. 
+ * Finished jobs nobody looked at are dropped, 
+ * the oldest first, beyond 32 of them.
+ */
+void capture::add(const std::vector<pid_t> &pids, const std::string &command, int pipe_fd)
+{
+    std::string size_var = utility::lookupVar("DMSH_JOB_BUFFER");
+    long long size = 256 << 10;
+    if (!size_var.empty() && (!utility::parseSize(size_var, size) || size <= 0))
+        size = 256 << 10;
+
+    Job job = {command, pids, pipe_fd, memfd_create("dmsh-job", MFD_CLOEXEC), nullptr, (size_t)size, 0};
+    if (job.Memfd != -1 && ftruncate(job.Memfd, job.Size) == 0)
+    {
+        void *map = mmap(NULL, job.Size, PROT_READ | PROT_WRITE, MAP_SHARED, job.Memfd, 0);
+        job.Ring = map == MAP_FAILED ? nullptr : (char *)map;
+    }
+    if (job.Ring == nullptr)
+    {
+        // Without a ring the output is read and dropped
+        perror("dmsh: job buffer");
+        job.Size = 0;
+    }
+    fcntl(pipe_fd, F_SETFL, O_NONBLOCK);
+
+    std::vector<int> stale;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto &entry : jobs)
+            if (finished(entry.second))
+                stale.push_back(entry.first);
+    }
+    for (size_t i = 0; i + 32 < stale.size(); i++)
+        release(stale[i]);
+    // A finished job of a reused pid
+    release(pids[0]);
+
+    std::lock_guard<std::mutex> guard(lock);
+    jobs[pids[0]] = job;
+    if (wake == -1)
+    {
+        wake = eventfd(0, EFD_CLOEXEC);
+        fed = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        std::thread(loop).detach();
+    }
+    uint64_t one = 1;
+    if (write(wake, &one, sizeof(one)) == -1)
+        perror("capture");
+}
+
+/**
+ * A job is finished once every writer closed 
+ * its pipe and the shell reaped its processes. 
+ * Called with lock held.
+ */
+bool capture::finished(const Job &job)
+{
+    if (job.Pipe != -1)
+        return false;
+    for (auto &pid : job.Pids)
+        if (std::find(running_jobs.begin(), running_jobs.end(), pid) != running_jobs.end())
+            return false;
+    return true;
+}
+
+// Drops a finished job along with its ring
+void capture::release(int id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = jobs.find(id);
+    if (it == jobs.end() || it->second.Pipe != -1)
+        return;
+    if (it->second.Ring)
+        munmap(it->second.Ring, it->second.Size);
+    if (it->second.Memfd != -1)
+        close(it->second.Memfd);
+    jobs.erase(it);
+}
+
+/**
+ * Following function is the body of the reader 
+ * thread. It blocks in poll over the wake up 
+ * eventfd and the pipes of the running jobs, 
+ * whatever is readable is copied into the ring 
+ * of that job (wrapping around, the oldest bytes 
+ * are overwritten). A pipe at EOF is closed, the 
+ * followers of a job are woken up on every read 
+ * through fed.
+ */
+void capture::loop()
+{
+    std::vector<struct pollfd> fds;
+    std::vector<char> buff(1 << 16);
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            fds.assign(1, {wake, POLLIN, 0});
+            for (auto &entry : jobs)
+                if (entry.second.Pipe != -1)
+                    fds.push_back({entry.second.Pipe, POLLIN, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) == -1)
+            continue;
+
+        uint64_t count;
+        if ((fds[0].revents & POLLIN) && read(wake, &count, sizeof(count)) == -1)
+            continue;
+
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t n = read(fds[i].fd, buff.data(), buff.size());
+            if (n == -1 && errno == EAGAIN)
+                continue;
+
+            std::lock_guard<std::mutex> guard(lock);
+            for (auto &entry : jobs)
+            {
+                Job &job = entry.second;
+                if (job.Pipe != fds[i].fd)
+                    continue;
+                if (n <= 0)
+                {
+                    close(job.Pipe);
+                    job.Pipe = -1;
+                }
+                for (ssize_t done = 0; job.Size > 0 && done < n;)
+                {
+                    size_t at = job.Total % job.Size;
+                    size_t chunk = std::min((size_t)(n - done), job.Size - at);
+                    memcpy(job.Ring + at, buff.data() + done, chunk);
+                    job.Total += chunk;
+                    done += chunk;
+                }
+                if (job.Size == 0 && n > 0)
+                    job.Total += n;
+                break;
+            }
+            uint64_t one = 1;
+            if (write(fed, &one, sizeof(one)) == -1)
+                perror("capture");
+        }
+    }
+}
+
+/**
+ * The following function writes the output of 
+ * job id to stdout, starting with the oldest 
+ * byte that is still in the ring. With follow 
+ * it waits for more until every writer of the 
+ * job is gone, or returns 130 on ^C. The job is 
+ * forgotten after that when it has finished.
+ */
+int capture::show(int id, bool follow)
+{
+    std::cout.flush();
+    std::unique_lock<std::mutex> guard(lock);
+    Job &job = jobs[id];
+    uint64_t offset = job.Total > job.Size ? job.Total - job.Size : 0;
+    if (offset > 0)
+        std::cerr << "dmsh: job " << id << ": first " << offset << " bytes dropped" << std::endl;
+
+    std::vector<char> out;
+    while (true)
+    {
+        if (follow && job.Total <= offset && job.Pipe != -1)
+        {
+            guard.unlock();
+            std::vector<struct pollfd> fds = {{fed, POLLIN, 0}};
+            uint64_t count;
+            if (events::wait(fds, -1) == -1 && errno == EINTR)
+                return 130;
+            if (read(fed, &count, sizeof(count)) == -1 && errno != EAGAIN)
+                perror("jobs");
+            guard.lock();
+            continue;
+        }
+
+        // Bytes the writer already went past are lost
+        offset = std::max(offset, job.Total > job.Size ? job.Total - job.Size : 0);
+        if (job.Size == 0)
+            offset = job.Total;
+        out.clear();
+        for (; job.Size > 0 && offset < job.Total; offset++)
+            out.push_back(job.Ring[offset % job.Size]);
+        bool end = !follow || job.Pipe == -1;
+
+        guard.unlock();
+        for (size_t done = 0; done < out.size();)
+        {
+            ssize_t n = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+            if (n <= 0)
+                return 1;
+            done += n;
+        }
+        guard.lock();
+        if (end && offset >= job.Total)
+            break;
+    }
+
+    guard.unlock();
+    utility::reapJobs();
+    guard.lock();
+    bool done = finished(job);
+    guard.unlock();
+    if (done)
+        release(id);
+    return 0;
+}
+
+/**
+ * The following function sets the event loop up 
+ * at startup: SIGINT and SIGCHLD are blocked (in 
+ * every thread started later as well) and go to 
+ * a signalfd. stdin is only waited on when it is 
+ * not a regular file, which is always readable. 
+ * With notify finished background jobs are 
+ * reported.
+ */
+void events::setup(bool report)
+{
+    notify = report;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sigfd == -1 || epfd == -1)
+    {
+        perror("dmsh: event loop");
+        return;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = sigfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+    ev.data.fd = STDIN_FILENO;
+    stdin_polled = epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+}
+
+// Children start with the signals the shell blocked delivered again
+void events::unblock()
+{
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+/**
+ * The following function adds the processes of 
+ * a background job to the loop, each through a 
+ * pidfd. A process without a pidfd is reaped on 
+ * SIGCHLD by reapJobs instead.
+ */
+void events::watch(const std::vector<pid_t> &pids, const std::string &command)
+{
+    for (size_t i = 0; epfd != -1 && i < pids.size(); i++)
+    {
+        int fd = syscall(SYS_pidfd_open, pids[i], 0);
+        if (fd == -1)
+            continue;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            close(fd);
+            continue;
+        }
+        children[fd] = {pids[i], pids[0], i + 1 == pids.size(), command};
+    }
+}
+
+/**
+ * Following function reaps the child behind a 
+ * readable pidfd. Once no child of its job is 
+ * left the job is reported, with the status of 
+ * its last stage.
+ */
+void events::reaped(int fd)
+{
+    Child child = children[fd];
+    children.erase(fd);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+
+    int wstatus;
+    if (waitpid(child.Pid, &wstatus, WNOHANG) == child.Pid)
+    {
+        running_jobs.erase(std::remove(running_jobs.begin(), running_jobs.end(), child.Pid), running_jobs.end());
+        if (child.Last)
+            job_status[child.Leader] = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+    }
+
+    for (auto &entry : children)
+        if (entry.second.Leader == child.Leader)
+            return;
+
+    int status = job_status.count(child.Leader) ? job_status[child.Leader] : 0;
+    job_status.erase(child.Leader);
+    if (!notify)
+        return;
+
+    std::string state = status == 0 ? "Done" : "Exit " + std::to_string(status);
+    std::cerr << (prompted ? "\n" : "") << "[" << child.Leader << "] " << std::left << std::setw(8) << state
+              << std::right << child.Command << std::endl;
+    if (prompted)
+        std::cout << prompt << std::flush;
+}
+
+/**
+ * The following function handles the events that 
+ * are ready, waiting for them up to timeout ms 
+ * (-1 for ever). Input on stdin is only noted, 
+ * readLine consumes it.
+ */
+void events::dispatch(int timeout)
+{
+    struct epoll_event evs[16];
+    int n = epfd == -1 ? 0 : epoll_wait(epfd, evs, 16, timeout);
+    for (int i = 0; i < n; i++)
+    {
+        int fd = evs[i].data.fd;
+        if (fd == sigfd)
+        {
+            struct signalfd_siginfo info;
+            while (read(sigfd, &info, sizeof(info)) == sizeof(info))
+            {
+                if (info.ssi_signo == SIGINT)
+                {
+                    interrupted = true;
+                    utility::interrupt();
+                }
+                else
+                {
+                    // Background processes that got no pidfd
+                    std::vector<pid_t> unwatched;
+                    for (auto &pid : running_jobs)
+                        if (std::none_of(children.begin(), children.end(), [&](const std::pair<const int, Child> &c) { return c.second.Pid == pid; }))
+                            unwatched.push_back(pid);
+                    for (auto &pid : unwatched)
+                        if (waitpid(pid, NULL, WNOHANG) != 0)
+                            running_jobs.erase(std::remove(running_jobs.begin(), running_jobs.end(), pid), running_jobs.end());
+                }
+            }
+        }
+        else if (children.count(fd))
+            reaped(fd);
+    }
+}
+
+/**
+ * The following function waits up to seconds 
+ * (-1 for ever) for one of fds to become ready, 
+ * handling the signals of the shell meanwhile. 
+ * Returns the result of poll, a ^C during the 
+ * wait fails it with EINTR.
+ */
+int events::wait(std::vector<struct pollfd> &fds, double seconds)
+{
+    fds.push_back({sigfd, POLLIN, 0});
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    int n = ppoll(fds.data(), fds.size(), seconds < 0 ? NULL : &ts, NULL);
+    bool signalled = n > 0 && (fds.back().revents & POLLIN);
+    fds.pop_back();
+    if (!signalled)
+        return n;
+
+    bool before = interrupted;
+    interrupted = false;
+    dispatch(0);
+    bool now = interrupted;
+    interrupted = before || now;
+    if (now)
+        errno = EINTR;
+    return now ? -1 : n - 1;
+}
+
+/**
+ * The following function waits until fd has 
+ * input, so a builtin reading a terminal or a 
+ * pipe still sees ^C while SIGINT is blocked. 
+ * A regular file never blocks. Returns 0 once 
+ * fd can be read and -1 (errno EINTR) on ^C.
+ */
+int events::readable(int fd)
+{
+    struct stat st;
+    if (sigfd == -1 || (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)))
+        return 0;
+
+    std::vector<struct pollfd> fds = {{fd, POLLIN, 0}};
+    int n;
+    while ((n = wait(fds, -1)) == 0)
+        ;
+    return n == -1 && errno == EINTR ? -1 : 0;
+}
+
+/**
+ * The following function returns the next line 
+ * of input in line, printing prompt once the 
+ * events that are already due have been handled. 
+ * While it waits finished jobs are reported. 
+ * Returns 1 for a line, 0 at the end of the input 
+ * and -1 when ^C was pressed.
+ */
+int events::readLine(std::string &line, const std::string &text)
+{
+    interrupted = false;
+    dispatch(0);
+    prompt = text;
+    std::cout << prompt << std::flush;
+    prompted = true;
+
+    char buff[4096];
+    while (pending.find('\n') == std::string::npos)
+    {
+        if (stdin_polled)
+        {
+            dispatch(-1);
+            if (interrupted)
+            {
+                prompted = false;
+                return -1;
+            }
+
+            struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+            if (poll(&in, 1, 0) <= 0)
+                continue;
+        }
+
+        ssize_t n = read(STDIN_FILENO, buff, sizeof(buff));
+        if (n == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0)
+        {
+            // The last line may have no newline
+            prompted = false;
+            if (pending.empty())
+                return 0;
+            line = pending;
+            pending.clear();
+            return 1;
+        }
+        pending.append(buff, n);
+    }
+
+    prompted = false;
+    size_t end = pending.find('\n');
+    line = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    return 1;
 }
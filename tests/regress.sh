@@ -0,0 +1,287 @@
+#!/usr/bin/env bash
+#
+# Regression tests for dmsh
+#
+# Every case runs one command line with dmsh -c and compares its output
+# (stdout and stderr) or its exit status against the expected value.
+# The startup file is skipped so the user's aliases do not interfere.
+#
+# Usage: tests/regress.sh
+
+DMSH=$(realpath "${DMSH:-./dmsh}")
+SCRATCH=$(mktemp -d)
+FAILED=0
+
+trap 'rm -rf "$SCRATCH"' EXIT
+export DMSH_RC=
+
+# expect NAME EXPECTED COMMAND: compare the combined output
+expect() {
+    local got
+    got=$(cd "$SCRATCH" && "$DMSH" -c "$3" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf "FAIL %s\n  expected: %q\n  got:      %q\n" "$1" "$2" "$got"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# status NAME EXPECTED COMMAND: compare the exit status
+status() {
+    (cd "$SCRATCH" && "$DMSH" -c "$3" > /dev/null 2>&1)
+    local got=$?
+    if [ "$got" != "$2" ]; then
+        printf "FAIL %s\n  expected status %s, got %s\n" "$1" "$2" "$got"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# layout NAME EXPECTED COMMAND: compare the combined output with every
+# number replaced by N and runs of spaces squeezed
+layout() {
+    local got
+    got=$(cd "$SCRATCH" && "$DMSH" -c "$3" 2>&1 | sed -E 's/[0-9]+(\.[0-9]+)?/N/g' | tr -s ' ')
+    if [ "$got" != "$2" ]; then
+        printf "FAIL %s\n  expected: %q\n  got:      %q\n" "$1" "$2" "$got"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# replaced NAME yes|no COMMAND: whether the pid COMMAND prints is the
+# shell's own, that is whether the shell exec'ed it
+replaced() {
+    (cd "$SCRATCH" && exec "$DMSH" -c "$3" > "$SCRATCH/probe" 2> /dev/null) &
+    local pid=$! got=no
+    wait "$pid"
+    [ "$(cat "$SCRATCH/probe")" = "$pid" ] && got=yes
+    if [ "$got" != "$2" ]; then
+        printf "FAIL %s\n  expected replaced: %s, got %s\n" "$1" "$2" "$got"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# session NAME EXPECTED LINE...: type the lines into one interactive
+# dmsh, 0.3s apart. PID stands for the pid a job wrote to the file pid,
+# in the lines sent after it exists and in the output
+session() {
+    local name=$1 want=$2 got
+    shift 2
+    rm -f "$SCRATCH/pid"
+    got=$(for line in "$@"; do
+        [ -f "$SCRATCH/pid" ] && line=${line//PID/$(cat "$SCRATCH/pid")}
+        echo "$line"
+        sleep 0.3
+    done | (cd "$SCRATCH" && "$DMSH") 2>&1)
+    [ -f "$SCRATCH/pid" ] && got=${got//$(cat "$SCRATCH/pid")/PID}
+    if [ "$got" != "$want" ]; then
+        printf "FAIL %s\n  expected: %q\n  got:      %q\n" "$name" "$want" "$got"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# interrupted NAME EXPECTED COMMAND: send SIGINT to the shell after
+# 0.3s, compare the exit status and require it to be back within 2s
+interrupted() {
+    local start=$(date +%s%N)
+    (cd "$SCRATCH" && exec "$DMSH" -c "$3" > /dev/null 2>&1) &
+    local pid=$!
+    sleep 0.3
+    kill -INT "$pid"
+    # A shell that ignored the ^C is killed once the time is up
+    for _ in $(seq 20); do
+        kill -0 "$pid" 2>/dev/null || break
+        sleep 0.1
+    done
+    kill -KILL "$pid" 2>/dev/null
+    wait "$pid" 2>/dev/null
+    local got=$? took=$((($(date +%s%N) - start) / 1000000))
+    if [ "$got" != "$2" ] || [ "$took" -ge 2000 ]; then
+        printf "FAIL %s\n  expected status %s within 2000ms, got %s after %sms\n" "$1" "$2" "$got" "$took"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# A plugin with the builtins cat and hello, for enable -f
+cat > "$SCRATCH/plugin.cpp" <<'CPP'
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" int dmsh_builtin_cat(std::vector<std::string> &)
+{
+    std::cout << "plugin cat" << std::endl;
+    return 0;
+}
+
+extern "C" int dmsh_builtin_hello(std::vector<std::string> &args)
+{
+    std::cout << "hello " << args.size() << std::endl;
+    return 0;
+}
+CPP
+${CXX:-g++} -std=c++17 -shared -fPIC "$SCRATCH/plugin.cpp" -o "$SCRATCH/plugin.so" || exit 1
+
+# expansion
+expect single-quoted '$HOME' "echo '\$HOME'"
+expect double-quoted "$HOME" "echo \"\$HOME\""
+expect awk-field "b
+d" "printf 'a b\nc d\n' > ab; awk '{print \$2}' ab"
+expect timeout-single-quoted '$HOME' "timeout 5 echo '\$HOME'"
+
+# basics
+expect echo "a b" "echo a b"
+status true 0 "true"
+status false 1 "false"
+
+# control flow
+expect while-loop "once" "true > flag; while test -f flag; do rm flag; echo once; done"
+expect for-loop "1a
+1b
+2a
+2b" "for i in 1 2; do for j in a b; do echo \$i\$j; done; done"
+expect for-range "1
+2
+3" "for i in {1..3}; do echo \$i; done"
+expect for-break "1
+2" "for i in 1 2 3 4; do if [ \$i = 3 ]; then break; fi; echo \$i; done"
+expect for-continue "1
+3" "for i in 1 2 3; do if [ \$i = 2 ]; then continue; fi; echo \$i; done"
+expect for-split-var "[a]
+[b]" "X='a b'; for w in \$X; do echo [\$w]; done"
+expect for-quoted-words "[a b]
+[c d]
+[e]" "for w in 'a b' \"c d\" e; do echo \"[\$w]\"; done"
+expect for-single-quoted '$HOME' "for w in '\$HOME'; do echo \"\$w\"; done"
+expect function "in a
+3" "f() { echo in \$1; return 3; echo no; }; f a; echo \$?"
+expect function-return-in-loop "4" "f() { for i in 1 2; do return 4; done; }; f; echo \$?"
+expect assign-single-quoted '$HOME' "X='\$HOME'; echo \"\$X\""
+expect assign-double-quoted "$HOME" "X=\"\$HOME\"; echo \$X"
+
+# printf
+expect printf-flags "[   42|ab  |3.14|ff|%]" "printf '[%5d|%-4s|%.2f|%x|%%]\n' 42 ab 3.14159 255"
+expect printf-star "printf: %*: invalid conversion specification" "printf '%*d' 5"
+expect printf-n "printf: %n: invalid conversion specification" "printf '%n' 1"
+expect printf-length "printf: %l: invalid conversion specification" "printf '%ld' 3"
+status printf-status 1 "printf '%*d' 5"
+
+# cat / tee
+expect cat-append "one
+two" "echo one > a; echo two > b; cat b >> a; cat a"
+expect cat-append-twice "x
+x" "echo x > c; cat c >> d; cat c >> d; cat d"
+expect tee-append "one
+two" "echo one > t; echo two | tee -a t > /dev/null; cat t"
+expect cat-empty-file "0" "true > empty; cat empty > copy; wc -c < copy"
+status cat-dev-null 0 "cat /dev/null > x.out"
+status cat-stdin-dev-null 0 "cat < /dev/null"
+expect cat-char-device "3" "cat /dev/zero | head -c 3 | wc -c"
+expect cat-char-device-file "4" "head -c 4 /dev/zero > four; cat /dev/null four /dev/null > out4; wc -c < out4"
+
+# xargs (one word of 131072 bytes is over MAX_ARG_STRLEN with its NUL)
+expect xargs-batch "a b c" "printf 'a\\nb\\nc\\n' | xargs echo"
+expect xargs-long-word "xargs: argument too long for echo" "printf 'short\\n' > words; head -c 131072 /dev/zero | tr '\\0' a >> words; xargs echo < words"
+status xargs-long-word-status 1 "head -c 131072 /dev/zero | tr '\\0' a | xargs echo"
+expect xargs-longest-word "131072" "head -c 131071 /dev/zero | tr '\\0' a | xargs echo | wc -c"
+
+# pipestat
+layout pipestat-report "hi
+pipestat:
+ # command wall(s) cpu(s) blocked(s) maxrss(KB) read(B) written(B)
+ N /bin/echo N N N N N N
+ N tee (shell) N N N - - -" "pipestat on; /bin/echo hi | tee"
+expect pipestat-toggle "pipestat on" "pipestat on; pipestat; pipestat off"
+
+# enable
+status enable-case 127 "enable -n echo; ECHO hi"
+expect enable-case-list "enable -n pwd" "enable -n PWD; enable | grep -e -n"
+expect enable-case-again "hi" "enable -n echo; enable ECHO; ECHO hi"
+expect enable-plugin-case "hello 1" "enable -f ./plugin.so hello; Hello z"
+expect enable-plugin-case-delete "hello: No such file or directory" "enable -f ./plugin.so hello; enable -d HELLO; hello"
+
+# timeouts
+status deadline-external 124 "export DMSH_TIMEOUT=1; /bin/sleep 3 | wc -c"
+status deadline-builtin-stage 124 "export DMSH_TIMEOUT=1; /bin/sleep 3 | tee /dev/null"
+status timeout-cat 124 "timeout -k 1 1 /bin/sleep 3 | cat"
+status deadline-cat 124 "export DMSH_TIMEOUT=1; /bin/sleep 3 | cat"
+expect deadline-lone-builtin "/" "export DMSH_TIMEOUT=1 > /dev/null; cd /; pwd"
+
+# pipeline rewrites
+printf 'a b\nc d\n' > "$SCRATCH/two"
+expect rewrite-cat-in "dmsh: optimize: cat-in: cat two | wc -l  =>  wc -l < two
+2" "optimize trace on; cat two | wc -l"
+expect rewrite-cat-out "dmsh: optimize: cat-out: /bin/echo x | cat  =>  /bin/echo x
+x" "optimize trace on; /bin/echo x | cat"
+expect rewrite-echo-feed "dmsh: optimize: echo-feed: echo a b | wc -w  =>  wc -w <<< 'a b'
+2" "optimize trace on; echo a b | wc -w"
+expect rewrite-builtin-cd "$SCRATCH" "cd / | cat; pwd"
+expect rewrite-builtin-exit "still here" "exit 3 | cat; echo still here"
+expect rewrite-plugin "plugin cat" "enable -f ./plugin.so cat; optimize trace on; cat two | cat"
+expect rewrite-off "2" "optimize off; optimize trace on; cat two | wc -l"
+
+# exec of the last command
+status tail-exec-status 1 "/bin/false"
+status tail-cat-out-status 0 "/bin/false | cat"
+replaced tail-exec-pid yes "sh -c 'echo \$\$'"
+replaced tail-exec-not-last no "sh -c 'echo \$\$'; true"
+replaced tail-exec-loop no "for i in 1; do sh -c 'echo \$\$'; done"
+replaced tail-exec-pipestat no "pipestat on; sh -c 'echo \$\$'"
+replaced tail-exec-timeout no "timeout 5 sh -c 'echo \$\$'"
+replaced tail-exec-pipeline no "sh -c 'echo \$\$' | tee"
+
+# cached (job.sh logs every run it makes)
+CACHE="export DMSH_CACHE_DIR=store > /dev/null; printf 'echo run | tee -a log\\nexit \$1\\n' > job.sh; rm -rf log store"
+expect cached-hit "run
+run
+1" "$CACHE; cached sh job.sh 0; cached sh job.sh 0; wc -l < log"
+expect cached-failure "run
+run
+2" "$CACHE; cached sh job.sh 3; cached sh job.sh 3; wc -l < log"
+expect cached-size "run
+run
+2" "$CACHE; export DMSH_CACHE_SIZE=1 > /dev/null; cached sh job.sh 0; cached sh job.sh 0; wc -l < log; ls store/entries"
+
+# rc snapshot (each $RUN is a new shell that reads rc, snap holds the snapshot)
+RUN="env DMSH_RC=rc DMSH_CACHE_DIR=snap $DMSH -c"
+SNAP="rm -rf snap; printf 'X=one\\n' > rc; touch -d @1000000000 rc"
+expect snapshot-warm "one
+one" "$SNAP; $RUN 'echo \$X'; $RUN 'echo \$X'"
+expect snapshot-used "one" "$SNAP; $RUN true; printf 'X=two\\n' > rc; touch -d @1000000000 rc; $RUN 'echo \$X'"
+expect snapshot-size "three" "$SNAP; $RUN true; printf 'X=three\\n' > rc; touch -d @1000000000 rc; $RUN 'echo \$X'"
+expect snapshot-mtime "two" "$SNAP; $RUN true; printf 'X=two\\n' > rc; $RUN 'echo \$X'"
+expect snapshot-touched "one
+kept" "$SNAP; $RUN true; ls -i snap > before; touch rc; $RUN 'echo \$X'; ls -i snap > after; cmp before after && echo kept"
+expect snapshot-env "a
+b" "$SNAP; printf 'X=\$FOO\\n' > rc; env FOO=a $RUN 'echo \$X'; env FOO=b $RUN 'echo \$X'"
+
+# background output (job.sh is the first stage, its pid is the job's)
+printf 'echo $$ > pid\necho out\necho err >&2\nprintf 0123456789abcdef\n' > "$SCRATCH/job.sh"
+session jobs-output "[PID] Command sent to background
+[PID] Done            24 bytes  sh job.sh &
+out
+err
+0123456789abcdef" "jobs -c on" "sh job.sh &" "jobs" "jobs -o %PID" "jobs"
+session jobs-ring "[PID] Command sent to background
+dmsh: job PID: first 12 bytes dropped
+456789abcdef" "jobs -c on" "DMSH_JOB_BUFFER=12" "sh job.sh &" "jobs -o %PID"
+expect jobs-unknown "jobs: %1: no such job" "jobs -o %1"
+
+# sleep
+status sleep-fraction 0 "sleep 0.1"
+status sleep-invalid 1 "sleep 1x"
+
+# ^C
+interrupted sigint-sleep 130 "sleep 5"
+interrupted sigint-pipeline 130 "/bin/sleep 5 | /bin/cat"
+interrupted sigint-xargs 130 "echo 5 5 | xargs -n 1 /bin/sleep"
+interrupted sigint-script-loop 130 "while true; do /bin/sleep 1; done"
+interrupted sigint-builtin-loop 130 "while true; do true; done"
+interrupted sigint-rest 130 "/bin/sleep 1; echo after-interrupt"
+interrupted sigint-cat 130 "optimize off; /bin/sleep 5 | cat"
+interrupted sigint-tee 130 "/bin/sleep 5 | tee log"
+interrupted sigint-xargs-input 130 "/bin/sleep 5 | xargs echo"
+
+if [ "$FAILED" -ne 0 ]; then
+    echo "$FAILED failed"
+    exit 1
+fi
+echo "all passed"